@@ -31,6 +31,7 @@
     "alaska.rep", \
     "amptjp.rep", \
     "bash.rep", \
+    "batch.rep", \
     "boat.rep",\
     "cccp.rep", \
     "chrome.rep", \
@@ -47,6 +48,7 @@
     "ls.rep", \
     "malloc.rep", \
     "malloc-free.rep", \
+    "memalign.rep", \
     "needle.rep", \
     "nlydf.rep", \
     "perl.rep", \
@@ -101,9 +103,14 @@
 #define UTIL_WEIGHT .61
 
 /*
- * Alignment requirement in bytes (either 4 or 8)
+ * Alignment requirement in bytes (either 4, 8, or 16 when the allocator
+ * is built with -DMM_ALIGN16)
  */
+#ifdef MM_ALIGN16
+#define ALIGNMENT 16
+#else
 #define ALIGNMENT 8
+#endif
 
 /*
  * Maximum heap size in bytes
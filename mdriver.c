@@ -10,6 +10,7 @@
 #include <assert.h>
 #include <errno.h>
 #include <float.h>
+#include <pthread.h>
 #include <setjmp.h>
 #include <signal.h>
 #include <stdarg.h>
@@ -37,6 +38,21 @@
 /* Returns true if p is ALIGNMENT-byte aligned */
 #define IS_ALIGNED(p)  ((((unsigned long)(p)) % ALIGNMENT) == 0)
 
+/* Bytes check_calloc dirties and then gets back from mm_calloc */
+#define CALLOC_BYTES (256*1024)
+#define CALLOC_OBJS  1024 /* at most this many objects, see check_calloc */
+
+/* Largest alignment check_aligned asks for, and the blocks it takes */
+#define ALIGNED_MAX  8192
+#define ALIGNED_OBJS 128
+
+#define SIZED_OBJS  512  /* blocks check_free_sized frees by size */
+
+/* Bytes check_arena allocates: several of mm.c's 16 KB arena chunks */
+#define ARENA_BYTES (64*1024)
+#define ARENA_OBJS  256  /* at most this many objects, see check_arena */
+#define POOL_OBJS   1024 /* objects check_pool takes: several 4 KB slabs */
+
 /* weights */
 #define WNONE 0
 #define WALL 1
@@ -64,9 +80,12 @@ typedef struct range_t {
 
 /* Characterizes a single trace operation (allocator request) */
 typedef struct {
-    enum { ALLOC, FREE, REALLOC } type; /* type of request */
+    enum { ALLOC, FREE, REALLOC, MEMALIGN,
+           MALLOC_BATCH, FREE_BATCH } type; /* type of request */
     int index;                        /* index for free() to use later */
     size_t size;                      /* byte size of alloc/realloc request */
+    size_t align;                     /* alignment of memalign request */
+    int count;                        /* ids index..index+count-1 of a batch */
 } traceop_t;
 
 /* Holds the information for one trace file*/
@@ -105,10 +124,32 @@ typedef struct {
 
     /* defined only for the student malloc package */
     double util;     /* space utilization for this trace (always 0 for libc) */
+    size_t heapsize; /* heap + mapped bytes left after the trace (0 for libc) */
+    size_t resident; /* bytes of heapsize resident in memory (0 for libc) */
+    unsigned long fit_calls;  /* find_fit calls in the last timed run (-p) */
+    unsigned long fit_nodes;  /* blocks they looked at */
+    unsigned long fit_cycles; /* cycles they took */
+    double frag_free; /* mean free share of the heap in the util run (-u) */
+    double frag_ext;  /* mean share of the free bytes not in the largest block */
 
     /* Note: secs and util are only defined if valid is true */
 } stats_t;
 
+/* One thread of a -T run, replaying the whole trace with its own blocks */
+typedef struct {
+    const trace_t *trace; /* shared by all threads, read only */
+    int tid;              /* thread number, picks the tag bytes */
+    char **blocks;        /* this thread's blocks, by id */
+    size_t *sizes;        /* ... and their payload sizes */
+    int oom;              /* set if the heap ran out of room */
+} thread_arg_t;
+
+/* One object of an arena or pool, see check_extents */
+typedef struct {
+    char *p;
+    size_t size;
+} extent_t;
+
 /* Summarizes the key statistics for a set of traces */
 typedef struct {
     double util;  /* average utilization expressed as a percentage */
@@ -140,6 +181,20 @@ static enum { DBG_NONE, DBG_CHEAP, DBG_EXPENSIVE } debug_mode = DBG_CHEAP;
 int verbose = 1;        /* global flag for verbose output */
 static int errors = 0;  /* number of errs found when running student malloc */
 int onetime_flag = 0;
+static int fit_stats_flag = 0; /* print find_fit stats (-p) */
+static int frag_stats_flag = 0; /* print fragmentation stats (-u) */
+static int threads_flag = 0; /* run the thread scaling test (-T) */
+
+/* Thread counts of the scaling test, and runs of each that it times */
+static const int thread_counts[] = { 1, 2, 4, 8 };
+#define NTHREAD_COUNTS (int)(sizeof(thread_counts) / sizeof(thread_counts[0]))
+#define THREAD_RUNS 3
+
+/* Byte that thread t writes at both ends of its block with id index */
+#define THREAD_TAG(t, index) ((unsigned char)((t) * 97 + (index) * 31 + 1))
+
+/* Times the util run samples fragmentation with -u */
+#define FRAG_SAMPLES 64
 
 /* by default, no timeouts */
 static int set_timeout = 0;
@@ -186,14 +241,35 @@ static void eval_libc_speed(void *ptr);
 /* Routines for evaluating correctnes, space utilization, and speed
    of the student's malloc package in mm.c */
 static int eval_mm_valid(trace_t *trace, range_t **ranges);
-static double eval_mm_util(trace_t *trace, int tracenum);
+static double eval_mm_util(trace_t *trace, int tracenum, size_t *heapsize,
+                           size_t *resident, stats_t *stats);
 static void eval_mm_speed(void *ptr);
+static void run_thread_tests(int num_tracefiles, const char *tracedir,
+                             char **tracefiles);
+
+/* One-time checks of the interfaces the traces do not replay */
+static void run_api_checks(void);
+static char *calloc_zeroed(int i);
+static int check_calloc(void);
+static int check_aligned(void);
+static int check_free_sized(void);
+static int check_extents(const char *check, extent_t *ext, int n,
+                         size_t align);
+static int check_arena(void);
+static int check_pool(void);
+static int check_huge(void);
+static int check_trim(const trace_t *trace, range_t **ranges, int live,
+                      size_t init_heapsize);
 
 /* Various helper routines */
 static void printresults(int n, stats_t *stats, sum_stats_t *sumstats);
+static void printfitstats(int n, stats_t *stats);
+static void printfragstats(int n, stats_t *stats);
 static void usage(void);
 static void malloc_error(const trace_t *trace, int opnum, const char *fmt, ...)
     __attribute__((format(printf, 3,4)));
+static void api_error(const char *check, const char *fmt, ...)
+    __attribute__((format(printf, 2,3)));
 static void unix_error(const char *fmt, ...)
     __attribute__((format(printf, 1,2), noreturn));
 static void app_error(const char *fmt, ...)
@@ -245,12 +321,18 @@ static void run_tests(int num_tracefiles, const char *tracedir,
         if (mm_stats[i].valid) {
             if (verbose > 1)
                 printf("efficiency, ");
-            mm_stats[i].util = eval_mm_util(trace, i);
+            mm_stats[i].util = eval_mm_util(trace, i, &mm_stats[i].heapsize,
+                                            &mm_stats[i].resident,
+                                            &mm_stats[i]);
             speed_params->trace = trace;
             speed_params->ranges = ranges;
             if (verbose > 1)
                 printf("and performance.\n");
             mm_stats[i].secs = fsecs(eval_mm_speed, speed_params);
+            /* mm_init resets the counts, so they are the last run's */
+            if (fit_stats_flag)
+                mm_fit_stats(&mm_stats[i].fit_calls, &mm_stats[i].fit_nodes,
+                             &mm_stats[i].fit_cycles);
         }
 
         free_trace(trace);
@@ -290,7 +372,7 @@ int main(int argc, char **argv)
     /*
      * Read and interpret the command line arguments
      */
-    while ((c = getopt(argc, argv, "d:f:c:s:t:v:hVAlD")) != EOF) {
+    while ((c = getopt(argc, argv, "d:f:c:g:s:t:v:hVAlDpuT")) != EOF) {
         switch (c) {
 
         case 'A': /* Hidden Autolab driver argument */
@@ -348,6 +430,30 @@ int main(int argc, char **argv)
             set_timeout = atoi(optarg);
             break;
 
+        case 'g': /* find_fit policy: budget[:slack] */
+            {
+                unsigned int budget, slack = 0;
+
+                if (sscanf(optarg, "%u:%u", &budget, &slack) < 1) {
+                    usage();
+                    exit(1);
+                }
+                mm_fit_policy(budget, slack);
+            }
+            break;
+
+        case 'p': /* Print find_fit cycles per block visited */
+            fit_stats_flag = 1;
+            break;
+
+        case 'u': /* Print free-space fragmentation over the util run */
+            frag_stats_flag = 1;
+            break;
+
+        case 'T': /* Replay each trace in 1, 2, 4 and 8 threads at once */
+            threads_flag = 1;
+            break;
+
         case 'h': /* Print this message */
             usage();
             exit(0);
@@ -419,6 +525,9 @@ int main(int argc, char **argv)
     if (verbose > 1)
         printf("\nTesting mm malloc\n");
 
+    /* Check the interfaces the traces do not replay, once */
+    run_api_checks();
+
     /* Allocate the mm stats array, with one stats_t struct per tracefile */
     mm_stats = (stats_t *)calloc(num_tracefiles, sizeof(stats_t));
     if (mm_stats == NULL)
@@ -441,9 +550,16 @@ int main(int argc, char **argv)
             printf("\nResults for mm malloc:\n");
             printresults(num_tracefiles, mm_stats, &global_mm_sum_stats);
             printf("\n");
+            if (fit_stats_flag)
+                printfitstats(num_tracefiles, mm_stats);
+            if (frag_stats_flag)
+                printfragstats(num_tracefiles, mm_stats);
         }
     }
 
+    if (threads_flag && !onetime_flag)
+        run_thread_tests(num_tracefiles, tracedir, tracefiles);
+
     /* Optionally compare the performance of mm and libc */
     if (run_libc) {
         printf("Comparison with libc malloc: mm/libc = %.0f Kops / %.0f Kops = %.2f\n", 
@@ -595,9 +711,20 @@ static int add_range(range_t **ranges, char *lo, int size,
         return 0;
     }
 
-    /* The payload must lie within the extent of the heap */
-    if ((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) ||
-        (hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) {
+    /* The package must report at least size usable bytes */
+    if (mm_malloc_usable_size(lo) < (size_t)size) {
+        malloc_error(trace, opnum, "mm_malloc_usable_size (%lu) is less than "
+                     "the payload size (%lu)",
+                     (unsigned long)mm_malloc_usable_size(lo),
+                     (unsigned long)size);
+        return 0;
+    }
+
+    /* The payload must lie within the extent of the heap, or within
+       one of the regions the package mapped with mem_mmap */
+    if (((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) ||
+         (hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) &&
+        !mem_is_mapped(lo, hi)) {
         malloc_error(trace, opnum,
                      "Payload (%p:%p) lies outside heap (%p:%p)",
                      lo, hi, mem_heap_lo(), mem_heap_hi());
@@ -743,7 +870,7 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
     FILE *tracefile;
     trace_t *trace;
     char type[MAXLINE];
-    int index, size;
+    int index, size, align, count;
     int max_index = 0;
     int op_index;
 
@@ -812,6 +939,29 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
             trace->ops[op_index].size = size;
             max_index = (index > max_index) ? index : max_index;
             break;
+        case 'm':
+            fscanf(tracefile, "%u %u %u", &index, &align, &size);
+            trace->ops[op_index].type = MEMALIGN;
+            trace->ops[op_index].index = index;
+            trace->ops[op_index].size = size;
+            trace->ops[op_index].align = align;
+            max_index = (index > max_index) ? index : max_index;
+            break;
+        case 'b':
+            fscanf(tracefile, "%u %u %u", &index, &count, &size);
+            trace->ops[op_index].type = MALLOC_BATCH;
+            trace->ops[op_index].index = index;
+            trace->ops[op_index].count = count;
+            trace->ops[op_index].size = size;
+            max_index = (index + count - 1 > max_index) ?
+                index + count - 1 : max_index;
+            break;
+        case 'F':
+            fscanf(tracefile, "%u %u", &index, &count);
+            trace->ops[op_index].type = FREE_BATCH;
+            trace->ops[op_index].index = index;
+            trace->ops[op_index].count = count;
+            break;
         case 'f':
             fscanf(tracefile, "%ud", &index);
             trace->ops[op_index].type = FREE;
@@ -869,14 +1019,17 @@ static void free_trace(trace_t *trace)
  */
 static int eval_mm_valid(trace_t *trace, range_t **ranges)
 {
-    int i;
+    int i, j;
     int index;
     size_t size;
+    size_t init_heapsize;
+    int live = 0;         /* blocks allocated and not yet freed */
     char *newp;
     char *oldp;
     char *p;
 
     /* Reset the heap and free any records in the range list */
+    mem_unmap_all();
     mem_reset_brk();
     clear_ranges(ranges);
     reinit_trace(trace);
@@ -886,6 +1039,7 @@ static int eval_mm_valid(trace_t *trace, range_t **ranges)
         malloc_error(trace, 0, "mm_init failed.");
         return 0;
     }
+    init_heapsize = mem_heapsize();
 
     /* Interpret each operation in the trace in order */
     for (i = 0;  i < trace->num_ops;  i++) {
@@ -909,11 +1063,25 @@ static int eval_mm_valid(trace_t *trace, range_t **ranges)
         switch (trace->ops[i].type) {
 
         case ALLOC: /* mm_malloc */
+        case MEMALIGN: /* mm_memalign */
 
-            /* Call the student's malloc */
-            if ((p = mm_malloc(size)) == NULL) {
-                malloc_error(trace, i, "mm_malloc failed.");
-                return 0;
+            /* Call the student's malloc or memalign */
+            if (trace->ops[i].type == ALLOC) {
+                if ((p = mm_malloc(size)) == NULL) {
+                    malloc_error(trace, i, "mm_malloc failed.");
+                    return 0;
+                }
+            } else {
+                if ((p = mm_memalign(trace->ops[i].align, size)) == NULL) {
+                    malloc_error(trace, i, "mm_memalign failed.");
+                    return 0;
+                }
+                if ((size_t)p % trace->ops[i].align != 0) {
+                    malloc_error(trace, i, "Payload address (%p) not aligned "
+                                 "to %lu bytes", p,
+                                 (unsigned long)trace->ops[i].align);
+                    return 0;
+                }
             }
 
             /*
@@ -927,6 +1095,7 @@ static int eval_mm_valid(trace_t *trace, range_t **ranges)
             /* Remember region */
             trace->blocks[index] = p;
             trace->block_sizes[index] = size;
+            live++;
 
             /* Set to random data, for debugging. */
             randomize_block(trace, index);
@@ -938,6 +1107,7 @@ static int eval_mm_valid(trace_t *trace, range_t **ranges)
             /* Call the student's realloc */
             oldp = trace->blocks[index];
             newp = mm_realloc(oldp, size);
+            live += (newp != NULL) - (oldp != NULL);
             if( (newp == NULL) && (size != 0) ) {
                 malloc_error(trace, i, "mm_realloc failed.");
                 return 0;
@@ -981,36 +1151,554 @@ static int eval_mm_valid(trace_t *trace, range_t **ranges)
             } else {
                 p = trace->blocks[index];
                 remove_range(ranges, p);
+                live -= (p != NULL);
             }
             mm_free(p);
             break;
 
+        case MALLOC_BATCH: /* mm_malloc_batch */
+            if (mm_malloc_batch(size, trace->ops[i].count,
+                                (void **)&trace->blocks[index]) !=
+                (size_t)trace->ops[i].count) {
+                malloc_error(trace, i, "mm_malloc_batch failed.");
+                return 0;
+            }
+            for (j = index; j < index + trace->ops[i].count; j++) {
+                if (add_range(ranges, trace->blocks[j], size, trace, i, j) == 0)
+                    return 0;
+                trace->block_sizes[j] = size;
+                randomize_block(trace, j);
+            }
+            live += trace->ops[i].count;
+            break;
+
+        case FREE_BATCH: /* mm_free_batch */
+            for (j = index; j < index + trace->ops[i].count; j++) {
+                check_index(trace, i, j);
+                remove_range(ranges, trace->blocks[j]);
+            }
+            /* The ids are dead now, so mm_free_batch may reorder them */
+            mm_free_batch((void **)&trace->blocks[index], trace->ops[i].count);
+            live -= trace->ops[i].count;
+            break;
+
         default:
             app_error("Nonexistent request type in eval_mm_valid");
         }
 
     }
 
+    if (check_trim(trace, ranges, live, init_heapsize) == 0)
+        return 0;
+
     /* As far as we know, this is a valid malloc package */
     return 1;
 }
 
+/*
+ * cmp_extent - qsort order of extents, by address
+ */
+static int cmp_extent(const void *a, const void *b)
+{
+    const char *p = ((const extent_t *)a)->p;
+    const char *q = ((const extent_t *)b)->p;
+
+    return (p > q) - (p < q);
+}
+
+/*
+ * check_extents - The n objects in ext, each filled with its own byte
+ *   when it was handed out, must be align-byte aligned, lie inside the
+ *   heap, not overlap and still hold their bytes. Sorts ext by address.
+ */
+static int check_extents(const char *check, extent_t *ext, int n,
+                         size_t align)
+{
+    char *lo = mem_heap_lo();
+    char *hi = mem_heap_hi();
+    size_t j;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        for (j = 0; j < ext[i].size; j++) {
+            if (ext[i].p[j] != (char)(i + 1)) {
+                api_error(check, "Object %d (%p, %lu bytes) was overwritten "
+                          "at byte %lu.", i, ext[i].p,
+                          (unsigned long)ext[i].size, (unsigned long)j);
+                return 0;
+            }
+        }
+    }
+    qsort(ext, n, sizeof(*ext), cmp_extent);
+    for (i = 0; i < n; i++) {
+        if ((unsigned long)ext[i].p % align != 0) {
+            api_error(check, "Object %p is not aligned to %lu bytes.",
+                      ext[i].p, (unsigned long)align);
+            return 0;
+        }
+        if (ext[i].p < lo || ext[i].p + ext[i].size - 1 > hi) {
+            api_error(check, "Object %p lies outside the heap.", ext[i].p);
+            return 0;
+        }
+        if (i > 0 && ext[i-1].p + ext[i-1].size > ext[i].p) {
+            api_error(check, "Objects %p and %p overlap.", ext[i-1].p,
+                      ext[i].p);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * check_arena - Create an arena and fill several of its chunks with
+ *   objects of assorted sizes, some of them big enough to get a chunk of
+ *   their own. They must be aligned, inside the heap and apart. The heap
+ *   must still check out after mm_arena_destroy.
+ */
+static int check_arena(void)
+{
+    static const size_t sizes[] = { 1, 24, 7, 1000, 16, 5000, 3, 2500, 100 };
+    extent_t ext[ARENA_OBJS];
+    mm_arena_t *arena;
+    size_t total = 0;
+    int n;
+
+    if ((arena = mm_arena_create()) == NULL) {
+        api_error("arena", "mm_arena_create failed.");
+        return 0;
+    }
+    if (mm_arena_alloc(arena, 0) != NULL) {
+        api_error("arena", "mm_arena_alloc of 0 bytes returned non-NULL.");
+        return 0;
+    }
+    for (n = 0; n < ARENA_OBJS && total < ARENA_BYTES; n++) {
+        ext[n].size = sizes[n % (sizeof(sizes) / sizeof(sizes[0]))];
+        if ((ext[n].p = mm_arena_alloc(arena, ext[n].size)) == NULL) {
+            api_error("arena", "mm_arena_alloc of %lu bytes failed.",
+                      (unsigned long)ext[n].size);
+            return 0;
+        }
+        memset(ext[n].p, n + 1, ext[n].size);
+        total += ext[n].size;
+    }
+    if (check_extents("arena", ext, n, ALIGNMENT) == 0)
+        return 0;
+    mm_arena_destroy(arena);
+    mm_checkheap(verbose);
+    return 1;
+}
+
+/*
+ * check_pool - For a few object sizes, take POOL_OBJS objects from a pool,
+ *   which refills it from new slabs several times, and check them like
+ *   check_arena does. Then free every other one and take as many again:
+ *   the free list must hand back exactly the freed slots, newest first,
+ *   and the objects must still check out. Object sizes that are not a
+ *   multiple of 8 make slots only 4-byte aligned, which the free list's
+ *   4-byte offsets must cope with.
+ */
+static int check_pool(void)
+{
+    static const size_t sizes[] = { 8, 12, 20, 64 };
+    static extent_t ext[POOL_OBJS];
+    mm_pool_t *pool;
+    size_t size, align;
+    unsigned int k;
+    int i;
+
+    if (mm_pool_create(0) != NULL || mm_pool_create((size_t)-1 / 2) != NULL) {
+        api_error("pool", "mm_pool_create of a bad size returned non-NULL.");
+        return 0;
+    }
+    for (k = 0; k < sizeof(sizes) / sizeof(sizes[0]); k++) {
+        size = sizes[k];
+        /* slots are as aligned as their (4-byte multiple) size allows */
+        align = size & -size;
+        if (align > ALIGNMENT)
+            align = ALIGNMENT;
+        if ((pool = mm_pool_create(size)) == NULL) {
+            api_error("pool", "mm_pool_create(%lu) failed.",
+                      (unsigned long)size);
+            return 0;
+        }
+        for (i = 0; i < POOL_OBJS; i++) {
+            if ((ext[i].p = mm_pool_alloc(pool)) == NULL) {
+                api_error("pool", "mm_pool_alloc of object %d failed.", i);
+                return 0;
+            }
+            ext[i].size = size;
+            memset(ext[i].p, i + 1, size);
+        }
+        if (check_extents("pool", ext, POOL_OBJS, align) == 0)
+            return 0;
+
+        /* ext is in address order now, so tag the objects afresh */
+        for (i = 0; i < POOL_OBJS; i++)
+            memset(ext[i].p, i + 1, size);
+        for (i = 1; i < POOL_OBJS; i += 2)
+            mm_pool_free(pool, ext[i].p);
+        mm_pool_free(pool, NULL);
+        /* the last odd index first */
+        for (i = (POOL_OBJS - 2) | 1; i > 0; i -= 2) {
+            if (mm_pool_alloc(pool) != ext[i].p) {
+                api_error("pool", "mm_pool_alloc did not reuse the slot "
+                          "freed last (%p).", ext[i].p);
+                return 0;
+            }
+            memset(ext[i].p, i + 1, size);
+        }
+        if (check_extents("pool", ext, POOL_OBJS, align) == 0)
+            return 0;
+        mm_pool_destroy(pool);
+    }
+    mm_checkheap(verbose);
+    return 1;
+}
+
+/*
+ * check_trim - Call mm_trim(0) at the end of a trace. It must return 1
+ *   exactly when the heap shrank, leave a heap that passes mm_checkheap
+ *   and keep the live blocks intact. If the trace freed every block and
+ *   the heap grew past its size after mm_init, the heap must shrink.
+ *   Blocks in thread caches stay allocated in the heap, and a scavenger
+ *   may trim first, so the last check only applies to the plain build.
+ */
+static int check_trim(const trace_t *trace, range_t **ranges, int live,
+                      size_t init_heapsize)
+{
+    size_t before = mem_heapsize();
+    size_t after;
+    int trimmed;
+    range_t *r;
+
+    trimmed = mm_trim(0);
+    after = mem_heapsize();
+    if (trimmed ? after >= before : after != before) {
+        malloc_error(trace, trace->num_ops, "mm_trim returned %d, but the "
+                     "heap went from %lu to %lu bytes.", trimmed,
+                     (unsigned long)before, (unsigned long)after);
+        return 0;
+    }
+#if !defined(MM_THREADSAFE) && !defined(MM_SCAVENGER)
+    if (live == 0 && before > init_heapsize && !trimmed) {
+        malloc_error(trace, trace->num_ops, "mm_trim left a heap of %lu "
+                     "bytes with no block allocated.", (unsigned long)after);
+        return 0;
+    }
+#endif
+    mm_checkheap(verbose);
+    for (r = *ranges; r != NULL; r = r->next)
+        check_index(trace, trace->num_ops, r->index);
+    return 1;
+}
+
+/*
+ * run_api_checks - Run each one-time check on a heap of its own. They
+ *   report through api_error, so a failure counts as an error of the
+ *   run without marking any trace invalid.
+ */
+static void run_api_checks(void)
+{
+    static int (*const checks[])(void) = { check_calloc, check_aligned,
+                                           check_free_sized, check_arena,
+                                           check_pool, check_huge };
+    size_t i;
+
+    mem_init();
+    for (i = 0; i < sizeof(checks) / sizeof(checks[0]); i++) {
+        mem_unmap_all();
+        mem_reset_brk();
+        if (mm_init() < 0)
+            app_error("mm_init failed in run_api_checks");
+        checks[i]();
+    }
+    mem_deinit();
+}
+
+/*
+ * calloc_zeroed - mm_calloc the i-th object of check_calloc, check that
+ *   it reads as zero and dirty it; NULL if any of that failed
+ */
+static char *calloc_zeroed(int i)
+{
+    static const size_t sizes[] = { 1, 24, 7, 1000, 16, 5000, 3, 2500, 100 };
+    size_t nmemb = i % 4 + 1;
+    size_t size = sizes[i % (sizeof(sizes) / sizeof(sizes[0]))];
+    size_t j;
+    char *p;
+
+    if ((p = mm_calloc(nmemb, size)) == NULL) {
+        api_error("calloc", "mm_calloc(%lu, %lu) failed.",
+                  (unsigned long)nmemb, (unsigned long)size);
+        return NULL;
+    }
+    for (j = 0; j < nmemb * size && p[j] == 0; j++)
+        ;
+    if (j < nmemb * size) {
+        api_error("calloc", "mm_calloc(%lu, %lu) returned a block with "
+                  "byte %lu not zero.", (unsigned long)nmemb,
+                  (unsigned long)size, (unsigned long)j);
+        return NULL;
+    }
+    memset(p, 0x5a, nmemb * size);
+    return p;
+}
+
+/*
+ * check_calloc - Dirty the heap with mm_malloc, reset it and fill it
+ *   again, further than before, with mm_calloc. Every byte must read as
+ *   zero, whether its block reuses the dirty heap, grows into memory
+ *   that was never touched or comes off a free list. An overflowing
+ *   request must fail.
+ */
+static int check_calloc(void)
+{
+    static char *objs[CALLOC_OBJS];
+    size_t total = 0;
+    size_t size;
+    int i, n;
+
+    for (n = 0; n < CALLOC_OBJS && total < CALLOC_BYTES; n++) {
+        size = 1000 + n % 7;
+        if ((objs[n] = mm_malloc(size)) == NULL) {
+            api_error("calloc", "mm_malloc of %lu bytes failed.",
+                      (unsigned long)size);
+            return 0;
+        }
+        memset(objs[n], 0xa5, size);
+        total += size;
+    }
+
+    /* the heap below the old break is dirty now */
+    mem_reset_brk();
+    if (mm_init() < 0)
+        app_error("mm_init failed in check_calloc");
+    for (i = 0; i < n; i++)
+        if ((objs[i] = calloc_zeroed(i)) == NULL)
+            return 0;
+    /* take back the blocks freed in between, dirty as they are */
+    for (i = 1; i < n; i += 2)
+        mm_free(objs[i]);
+    for (i = 1; i < n; i += 2)
+        if ((objs[i] = calloc_zeroed(i)) == NULL)
+            return 0;
+
+    if (mm_calloc((size_t)-1 / 2 + 1, 2) != NULL) {
+        api_error("calloc", "mm_calloc of an overflowing size returned "
+                  "non-NULL.");
+        return 0;
+    }
+    mm_checkheap(verbose);
+    return 1;
+}
+
+/*
+ * check_aligned - mm_posix_memalign must fail with EINVAL, and leave
+ *   *memptr alone, unless the alignment is a power of 2 and a multiple
+ *   of sizeof(void *). For every such alignment up to ALIGNED_MAX, it
+ *   and mm_aligned_alloc must return aligned blocks, from the heap and
+ *   from mappings, that keep their bytes until they are freed.
+ */
+static int check_aligned(void)
+{
+    static const size_t bad[] = { 0, sizeof(void *) / 2, 3 * sizeof(void *) };
+    static const size_t sizes[] = { 1, 100, 5000, 200000 };
+    static extent_t ext[ALIGNED_OBJS];
+    size_t align, j;
+    unsigned int k;
+    void *p;
+    int i, n = 0;
+    int ret;
+
+    for (k = 0; k < sizeof(bad) / sizeof(bad[0]); k++) {
+        p = &p;
+        if ((ret = mm_posix_memalign(&p, bad[k], 64)) != EINVAL || p != &p) {
+            api_error("aligned", "mm_posix_memalign with alignment %lu "
+                      "returned %d, not EINVAL.", (unsigned long)bad[k], ret);
+            return 0;
+        }
+    }
+    for (align = sizeof(void *); align <= ALIGNED_MAX; align *= 2) {
+        for (k = 0; k < sizeof(sizes) / sizeof(sizes[0]); k++) {
+            ext[n].size = ext[n+1].size = sizes[k];
+            if ((ret = mm_posix_memalign(&p, align, sizes[k])) != 0) {
+                api_error("aligned", "mm_posix_memalign(%lu, %lu) failed "
+                          "(%d).", (unsigned long)align,
+                          (unsigned long)sizes[k], ret);
+                return 0;
+            }
+            ext[n].p = p;
+            if ((ext[n+1].p = mm_aligned_alloc(align, sizes[k])) == NULL) {
+                api_error("aligned", "mm_aligned_alloc(%lu, %lu) failed.",
+                          (unsigned long)align, (unsigned long)sizes[k]);
+                return 0;
+            }
+            for (i = n; i < n + 2; i++) {
+                if ((unsigned long)ext[i].p % align != 0) {
+                    api_error("aligned", "%s returned %p, not aligned to "
+                              "%lu bytes.", i == n ? "mm_posix_memalign" :
+                              "mm_aligned_alloc", ext[i].p,
+                              (unsigned long)align);
+                    return 0;
+                }
+                memset(ext[i].p, i + 1, ext[i].size);
+            }
+            n += 2;
+        }
+    }
+    for (i = 0; i < n; i++) {
+        for (j = 0; j < ext[i].size && ext[i].p[j] == (char)(i + 1); j++)
+            ;
+        if (j < ext[i].size) {
+            api_error("aligned", "Block %p (%lu bytes) was overwritten at "
+                      "byte %lu.", ext[i].p, (unsigned long)ext[i].size,
+                      (unsigned long)j);
+            return 0;
+        }
+        mm_free(ext[i].p);
+    }
+    mm_checkheap(verbose);
+    return 1;
+}
+
+/*
+ * check_free_sized - Free every other block of assorted sizes, some of
+ *   them mapped and some shrunk by mm_realloc first, with mm_free_sized
+ *   and its last requested size. The blocks left must keep their bytes,
+ *   the freed ones must be taken again by as many mm_mallocs, and the
+ *   heap must check out once everything is freed that way.
+ */
+static int check_free_sized(void)
+{
+    static const size_t sizes[] = { 1, 24, 7, 1000, 16, 5000, 3, 200000, 100 };
+    static extent_t ext[SIZED_OBJS];
+    size_t j;
+    int i, pass;
+
+    for (i = 0; i < SIZED_OBJS; i++) {
+        ext[i].size = sizes[i % (sizeof(sizes) / sizeof(sizes[0]))];
+        if ((ext[i].p = mm_malloc(ext[i].size)) == NULL) {
+            api_error("free_sized", "mm_malloc of %lu bytes failed.",
+                      (unsigned long)ext[i].size);
+            return 0;
+        }
+        if (i % 5 == 4) {
+            ext[i].size = ext[i].size / 2 + 1;
+            if ((ext[i].p = mm_realloc(ext[i].p, ext[i].size)) == NULL) {
+                api_error("free_sized", "mm_realloc to %lu bytes failed.",
+                          (unsigned long)ext[i].size);
+                return 0;
+            }
+        }
+        memset(ext[i].p, i + 1, ext[i].size);
+    }
+    mm_free_sized(NULL, 8);
+
+    /* the odd blocks go, come back and go again with the even ones */
+    for (pass = 0; pass < 2; pass++) {
+        for (i = 1; i < SIZED_OBJS; i += 2)
+            mm_free_sized(ext[i].p, ext[i].size);
+        for (i = 0; i < SIZED_OBJS; i += 2) {
+            for (j = 0; j < ext[i].size && ext[i].p[j] == (char)(i + 1); j++)
+                ;
+            if (j < ext[i].size) {
+                api_error("free_sized", "Block %p (%lu bytes) was "
+                          "overwritten at byte %lu.", ext[i].p,
+                          (unsigned long)ext[i].size, (unsigned long)j);
+                return 0;
+            }
+        }
+        if (pass == 1)
+            break;
+        for (i = 1; i < SIZED_OBJS; i += 2) {
+            if ((ext[i].p = mm_malloc(ext[i].size)) == NULL) {
+                api_error("free_sized", "mm_malloc of %lu bytes failed.",
+                          (unsigned long)ext[i].size);
+                return 0;
+            }
+            memset(ext[i].p, i + 1, ext[i].size);
+        }
+    }
+    for (i = 0; i < SIZED_OBJS; i += 2)
+        mm_free_sized(ext[i].p, ext[i].size);
+    mm_checkheap(verbose);
+    return 1;
+}
+
+/*
+ * check_huge - Requests so big that computing their block size would
+ *   overflow must fail, and a failed mm_realloc must leave its block
+ *   as it was. Growing the last block of the heap past what a header
+ *   can hold must fail or give a block that takes every byte asked for.
+ */
+static int check_huge(void)
+{
+    static const size_t sizes[] = {
+        (size_t)-1, (size_t)-8, (size_t)-1 / 2 + 1
+    };
+    void *out[2];
+    unsigned int k;
+    size_t size;
+    char *p, *q;
+
+    if ((p = mm_malloc(64)) == NULL) {
+        api_error("huge", "mm_malloc of 64 bytes failed.");
+        return 0;
+    }
+    memset(p, 0x5a, 64);
+    for (k = 0; k < sizeof(sizes) / sizeof(sizes[0]); k++) {
+        if (mm_malloc(sizes[k]) != NULL) {
+            api_error("huge", "mm_malloc(%#lx) returned non-NULL.",
+                      (unsigned long)sizes[k]);
+            return 0;
+        }
+        if (mm_malloc_batch(sizes[k], 2, out) != 0) {
+            api_error("huge", "mm_malloc_batch(%#lx, 2) returned blocks.",
+                      (unsigned long)sizes[k]);
+            return 0;
+        }
+        if (mm_realloc(p, sizes[k]) != NULL || p[0] != 0x5a || p[63] != 0x5a) {
+            api_error("huge", "mm_realloc(%p, %#lx) did not fail and leave "
+                      "the block alone.", p, (unsigned long)sizes[k]);
+            return 0;
+        }
+    }
+
+    /* the fresh heap's last block is p, which mm_realloc would grow */
+    size = ((size_t)1 << 32) + 100;
+    if ((q = mm_realloc(p, size)) != NULL) {
+        if (q[0] != 0x5a || q[63] != 0x5a) {
+            api_error("huge", "mm_realloc to %#lx bytes lost the old "
+                      "bytes.", (unsigned long)size);
+            return 0;
+        }
+        q[size - 1] = 0x5a;
+        p = q;
+    }
+    mm_free(p);
+    mm_checkheap(verbose);
+    return 1;
+}
+
 /*
  * eval_mm_util - Evaluate the space utilization of the student's package
  *   The idea is to remember the high water mark "hwm" of the heap for
  *   an optimal allocator, i.e., no gaps and no internal fragmentation.
  *   Utilization is the ratio hwm/heapsize, where heapsize is the
  *   size of the heap in bytes after running the student's malloc
- *   package on the trace. Note that our implementation of mem_sbrk()
- *   doesn't allow the students to decrement the brk pointer, so brk
- *   is always the high water mark of the heap.
+ *   package on the trace. The package may decrement the brk pointer,
+ *   so memlib keeps the high water mark of the heap (plus mappings).
  *
  *   A higher number is better: 1 is optimal.
  */
-static double eval_mm_util(trace_t *trace, int tracenum)
+static double eval_mm_util(trace_t *trace, int tracenum, size_t *heapsize,
+                           size_t *resident, stats_t *stats)
 {
-    int i;
-    int index;
+    int i, j;
+    int samples = 0;
+    int every = trace->num_ops / FRAG_SAMPLES + 1;
+    size_t free_bytes, largest;
+    int index, count;
     int size, newsize, oldsize;
     int max_total_size = 0;
     int total_size = 0;
@@ -1020,6 +1708,9 @@ static double eval_mm_util(trace_t *trace, int tracenum)
     reinit_trace(trace);
 
     /* initialize the heap and the mm malloc package */
+    /* start from fresh memory so only this trace's pages count as resident */
+    mem_deinit();
+    mem_init();
     mem_reset_brk();
     if (mm_init() < 0)
         app_error("trace %d: mm_init failed in eval_mm_util", tracenum);
@@ -1028,10 +1719,15 @@ static double eval_mm_util(trace_t *trace, int tracenum)
         switch (trace->ops[i].type) {
 
         case ALLOC: /* mm_alloc */
+        case MEMALIGN: /* mm_memalign */
             index = trace->ops[i].index;
             size = trace->ops[i].size;
 
-            if ((p = mm_malloc(size)) == NULL) {
+            if (trace->ops[i].type == ALLOC)
+                p = mm_malloc(size);
+            else
+                p = mm_memalign(trace->ops[i].align, size);
+            if (p == NULL) {
                 app_error("trace %d: mm_malloc failed in eval_mm_util",
                           tracenum);
             }
@@ -1076,6 +1772,27 @@ static double eval_mm_util(trace_t *trace, int tracenum)
             total_size -= size;
             break;
 
+        case MALLOC_BATCH: /* mm_malloc_batch */
+            index = trace->ops[i].index;
+            size = trace->ops[i].size;
+            count = trace->ops[i].count;
+            if (mm_malloc_batch(size, count, (void **)&trace->blocks[index])
+                != (size_t)count)
+                app_error("trace %d: mm_malloc_batch failed in eval_mm_util",
+                          tracenum);
+            for (j = index; j < index + count; j++)
+                trace->block_sizes[j] = size;
+            total_size += size * count;
+            break;
+
+        case FREE_BATCH: /* mm_free_batch */
+            index = trace->ops[i].index;
+            count = trace->ops[i].count;
+            for (j = index; j < index + count; j++)
+                total_size -= trace->block_sizes[j];
+            mm_free_batch((void **)&trace->blocks[index], count);
+            break;
+
         default:
             app_error("trace %d: Nonexistent request type in eval_mm_util",
                       tracenum);
@@ -1084,11 +1801,30 @@ static double eval_mm_util(trace_t *trace, int tracenum)
         /* update the high-water mark */
         max_total_size = (total_size > max_total_size) ?
             total_size : max_total_size;
+
+        /* sample how the free space in the heap is split up */
+        if (frag_stats_flag && i % every == every - 1) {
+            mm_frag_stats(&free_bytes, &largest);
+            if (mem_heapsize() > 0)
+                stats->frag_free += (double)free_bytes / mem_heapsize();
+            if (free_bytes > 0)
+                stats->frag_ext += 1.0 - (double)largest / free_bytes;
+            samples++;
+        }
+    }
+    if (samples > 0) {
+        stats->frag_free /= samples;
+        stats->frag_ext /= samples;
     }
 
     printf(".");
 
-    return ((double)max_total_size / (double)mem_heapsize());
+    /* What the package still holds at the end, e.g. after trimming */
+    *heapsize = mem_heapsize() + mem_mapsize();
+    *resident = mem_resident();
+
+    /* Mapped regions count against the package just like heap pages */
+    return ((double)max_total_size / (double)mem_peaksize());
 }
 
 
@@ -1104,6 +1840,7 @@ static void eval_mm_speed(void *ptr)
     reinit_trace(trace);
 
     /* Reset the heap and initialize the mm package */
+    mem_unmap_all();
     mem_reset_brk();
     if (mm_init() < 0)
         app_error("mm_init failed in eval_mm_speed");
@@ -1120,6 +1857,14 @@ static void eval_mm_speed(void *ptr)
             trace->blocks[index] = p;
             break;
 
+        case MEMALIGN: /* mm_memalign */
+            index = trace->ops[i].index;
+            size = trace->ops[i].size;
+            if ((p = mm_memalign(trace->ops[i].align, size)) == NULL)
+                app_error("mm_memalign error in eval_mm_speed");
+            trace->blocks[index] = p;
+            break;
+
         case REALLOC: /* mm_realloc */
             index = trace->ops[i].index;
             newsize = trace->ops[i].size;
@@ -1139,11 +1884,253 @@ static void eval_mm_speed(void *ptr)
             mm_free(block);
             break;
 
+        case MALLOC_BATCH: /* mm_malloc_batch */
+            index = trace->ops[i].index;
+            if (mm_malloc_batch(trace->ops[i].size, trace->ops[i].count,
+                                (void **)&trace->blocks[index]) !=
+                (size_t)trace->ops[i].count)
+                app_error("mm_malloc_batch error in eval_mm_speed");
+            break;
+
+        case FREE_BATCH: /* mm_free_batch */
+            index = trace->ops[i].index;
+            mm_free_batch((void **)&trace->blocks[index], trace->ops[i].count);
+            break;
+
         default:
             app_error("Nonexistent request type in eval_mm_speed");
         }
 }
 
+/*
+ * thread_check - check the tag bytes at both ends of block index of
+ *     thread arg, which another thread's block must not have overwritten
+ */
+static void thread_check(thread_arg_t *arg, int opnum, int index)
+{
+    unsigned char tag = THREAD_TAG(arg->tid, index);
+    unsigned char *p = (unsigned char *)arg->blocks[index];
+    size_t size = arg->sizes[index];
+
+    if (p == NULL || size == 0)
+        return;
+    if (p[0] != tag || p[size - 1] != tag) {
+        __atomic_add_fetch(&errors, 1, __ATOMIC_RELAXED);
+        printf("ERROR [trace %s, line %d, thread %d]: block %d was "
+               "overwritten\n", arg->trace->filename, LINENUM(opnum),
+               arg->tid, index);
+    }
+}
+
+/*
+ * thread_tag - write the tag bytes at both ends of block index
+ */
+static void thread_tag(thread_arg_t *arg, int index)
+{
+    unsigned char *p = (unsigned char *)arg->blocks[index];
+    size_t size = arg->sizes[index];
+
+    if (p == NULL || size == 0)
+        return;
+    p[0] = p[size - 1] = THREAD_TAG(arg->tid, index);
+}
+
+/*
+ * thread_replay - body of one thread of a -T run: replay the trace on the
+ *     shared heap, tagging each block and checking the tags before the
+ *     block is reallocated or freed. Stops early (setting oom) if the heap
+ *     runs out of room, which n copies of a big trace can do.
+ */
+static void *thread_replay(void *ptr)
+{
+    thread_arg_t *arg = ptr;
+    const trace_t *trace = arg->trace;
+    int i, j, index, count;
+    size_t size;
+    char *p;
+
+    for (i = 0; i < trace->num_ops; i++) {
+        index = trace->ops[i].index;
+        size = trace->ops[i].size;
+
+        switch (trace->ops[i].type) {
+        case ALLOC: /* mm_malloc */
+        case MEMALIGN: /* mm_memalign */
+            p = trace->ops[i].type == ALLOC ? mm_malloc(size) :
+                mm_memalign(trace->ops[i].align, size);
+            if (p == NULL) {
+                arg->oom = 1;
+                return NULL;
+            }
+            arg->blocks[index] = p;
+            arg->sizes[index] = size;
+            thread_tag(arg, index);
+            break;
+
+        case REALLOC: /* mm_realloc */
+            thread_check(arg, i, index);
+            p = mm_realloc(arg->blocks[index], size);
+            if (p == NULL && size != 0) {
+                arg->oom = 1;
+                return NULL;
+            }
+            arg->blocks[index] = p;
+            // the first byte was copied, so its tag must have come along
+            if (p != NULL && arg->sizes[index] != 0 &&
+                (unsigned char)p[0] != THREAD_TAG(arg->tid, index)) {
+                __atomic_add_fetch(&errors, 1, __ATOMIC_RELAXED);
+                printf("ERROR [trace %s, line %d, thread %d]: mm_realloc "
+                       "lost the data of block %d\n", trace->filename,
+                       LINENUM(i), arg->tid, index);
+            }
+            arg->sizes[index] = size;
+            thread_tag(arg, index);
+            break;
+
+        case FREE: /* mm_free */
+            if (index < 0) {
+                mm_free(NULL);
+                break;
+            }
+            thread_check(arg, i, index);
+            mm_free(arg->blocks[index]);
+            arg->blocks[index] = NULL;
+            break;
+
+        case MALLOC_BATCH: /* mm_malloc_batch */
+            count = trace->ops[i].count;
+            if (mm_malloc_batch(size, count, (void **)&arg->blocks[index]) !=
+                (size_t)count) {
+                arg->oom = 1;
+                return NULL;
+            }
+            for (j = index; j < index + count; j++) {
+                arg->sizes[j] = size;
+                thread_tag(arg, j);
+            }
+            break;
+
+        case FREE_BATCH: /* mm_free_batch */
+            count = trace->ops[i].count;
+            for (j = index; j < index + count; j++)
+                thread_check(arg, i, j);
+            mm_free_batch((void **)&arg->blocks[index], count);
+            break;
+
+        default:
+            app_error("Nonexistent request type in thread_replay");
+        }
+    }
+    return NULL;
+}
+
+/*
+ * eval_mm_threads - replay trace in nthreads threads at once on one heap.
+ *     Returns the seconds it took, or -1 if the heap ran out of room.
+ */
+static double eval_mm_threads(const trace_t *trace, int nthreads)
+{
+    pthread_t tids[nthreads];
+    thread_arg_t args[nthreads];
+    struct timespec start, end;
+    int oom = 0;
+    int t;
+
+    mem_unmap_all();
+    mem_reset_brk();
+    if (mm_init() < 0)
+        app_error("mm_init failed in eval_mm_threads");
+
+    for (t = 0; t < nthreads; t++) {
+        args[t].trace = trace;
+        args[t].tid = t;
+        args[t].oom = 0;
+        args[t].blocks = calloc(trace->num_ids, sizeof(char *));
+        args[t].sizes = calloc(trace->num_ids, sizeof(size_t));
+        if (args[t].blocks == NULL || args[t].sizes == NULL)
+            unix_error("calloc failed in eval_mm_threads");
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (t = 0; t < nthreads; t++) {
+        if ((errno = pthread_create(&tids[t], NULL, thread_replay,
+                                    &args[t])) != 0)
+            unix_error("pthread_create failed in eval_mm_threads");
+    }
+    for (t = 0; t < nthreads; t++)
+        pthread_join(tids[t], NULL);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    // the exited threads have flushed their caches back into the heap
+    mm_checkheap(0);
+    for (t = 0; t < nthreads; t++) {
+        oom |= args[t].oom;
+        free(args[t].blocks);
+        free(args[t].sizes);
+    }
+    if (oom)
+        return -1;
+    return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+/*
+ * run_thread_tests - for each trace, time 1, 2, 4 and 8 threads that each
+ *     replay the whole trace on one heap, and print the throughput of
+ *     each (the best of THREAD_RUNS runs) and the speedup of the last over
+ *     one thread. Blocks are tagged and checked, so this doubles as a
+ *     stress test of the thread-safe build.
+ */
+static void run_thread_tests(int num_tracefiles, const char *tracedir,
+                             char **tracefiles)
+{
+    stats_t stats;
+    trace_t *trace;
+    double secs, best;
+    double kops[NTHREAD_COUNTS];
+    int i, k, run;
+
+#if !defined(MM_THREADSAFE) && !defined(MM_SCAVENGER)
+    printf("Thread scaling: build mm.c with MMFLAGS=-DMM_THREADSAFE\n");
+    return;
+#endif
+    printf("Thread scaling (Kops, every thread replays the whole trace, "
+           "%ld CPUs online):\n", sysconf(_SC_NPROCESSORS_ONLN));
+    for (k = 0; k < NTHREAD_COUNTS; k++)
+        printf("%6d thr", thread_counts[k]);
+    printf("%8s  %s\n", "speedup", "trace");
+
+    for (i = 0; i < num_tracefiles; i++) {
+        mem_init();
+        trace = read_trace(&stats, tracedir, tracefiles[i]);
+        for (k = 0; k < NTHREAD_COUNTS; k++) {
+            best = -1;
+            for (run = 0; run < THREAD_RUNS; run++) {
+                secs = eval_mm_threads(trace, thread_counts[k]);
+                if (secs < 0) {
+                    best = -1;
+                    break;
+                }
+                if (best < 0 || secs < best)
+                    best = secs;
+            }
+            kops[k] = best > 0 ?
+                thread_counts[k] * trace->num_ops / 1e3 / best : 0;
+            if (best < 0)
+                printf("%10s", "--");
+            else
+                printf("%10.0f", kops[k]);
+        }
+        if (kops[0] > 0 && kops[NTHREAD_COUNTS - 1] > 0)
+            printf("%8.2f", kops[NTHREAD_COUNTS - 1] / kops[0]);
+        else
+            printf("%8s", "--");
+        printf("  %s\n", trace->filename);
+        free_trace(trace);
+        mem_deinit();
+    }
+    printf("\n");
+}
+
 /*
  * eval_libc_valid - We run this function to make sure that the
  *    libc malloc can run to completion on the set of traces.
@@ -1152,7 +2139,7 @@ static void eval_mm_speed(void *ptr)
  */
 static int eval_libc_valid(trace_t *trace)
 {
-    int i, newsize;
+    int i, j, newsize;
     char *p, *newp, *oldp;
 
     reinit_trace(trace);
@@ -1168,6 +2155,15 @@ static int eval_libc_valid(trace_t *trace)
             trace->blocks[trace->ops[i].index] = p;
             break;
 
+        case MEMALIGN: /* posix_memalign */
+            if (posix_memalign((void **)&p, trace->ops[i].align,
+                               trace->ops[i].size) != 0) {
+                malloc_error(trace, i, "libc posix_memalign failed");
+                unix_error("System message");
+            }
+            trace->blocks[trace->ops[i].index] = p;
+            break;
+
         case REALLOC: /* realloc */
             newsize = trace->ops[i].size;
             oldp = trace->blocks[trace->ops[i].index];
@@ -1186,6 +2182,21 @@ static int eval_libc_valid(trace_t *trace)
             }
             break;
 
+        case MALLOC_BATCH: /* malloc, one block at a time */
+            for (j = 0; j < trace->ops[i].count; j++) {
+                if ((p = malloc(trace->ops[i].size)) == NULL) {
+                    malloc_error(trace, i, "libc malloc failed");
+                    unix_error("System message");
+                }
+                trace->blocks[trace->ops[i].index + j] = p;
+            }
+            break;
+
+        case FREE_BATCH: /* free, one block at a time */
+            for (j = 0; j < trace->ops[i].count; j++)
+                free(trace->blocks[trace->ops[i].index + j]);
+            break;
+
         default:
             app_error("invalid operation type  in eval_libc_valid");
         }
@@ -1201,7 +2212,7 @@ static int eval_libc_valid(trace_t *trace)
  */
 static void eval_libc_speed(void *ptr)
 {
-    int i;
+    int i, j;
     int index, size, newsize;
     char *p, *newp, *oldp, *block;
     trace_t *trace = ((speed_t *)ptr)->trace;
@@ -1218,6 +2229,14 @@ static void eval_libc_speed(void *ptr)
             trace->blocks[index] = p;
             break;
 
+        case MEMALIGN: /* posix_memalign */
+            index = trace->ops[i].index;
+            size = trace->ops[i].size;
+            if (posix_memalign((void **)&p, trace->ops[i].align, size) != 0)
+                unix_error("posix_memalign failed in eval_libc_speed");
+            trace->blocks[index] = p;
+            break;
+
         case REALLOC: /* realloc */
             index = trace->ops[i].index;
             newsize = trace->ops[i].size;
@@ -1237,6 +2256,20 @@ static void eval_libc_speed(void *ptr)
                 free(0);
             }
             break;
+
+        case MALLOC_BATCH: /* malloc, one block at a time */
+            index = trace->ops[i].index;
+            for (j = 0; j < trace->ops[i].count; j++)
+                if ((trace->blocks[index + j] =
+                     malloc(trace->ops[i].size)) == NULL)
+                    unix_error("malloc failed in eval_libc_speed");
+            break;
+
+        case FREE_BATCH: /* free, one block at a time */
+            index = trace->ops[i].index;
+            for (j = 0; j < trace->ops[i].count; j++)
+                free(trace->blocks[index + j]);
+            break;
         }
     }
 }
@@ -1264,8 +2297,8 @@ static void printresults(int n, stats_t *stats, sum_stats_t *sumstats)
     char wstr;
 
     /* Print the individual results for each trace */
-    printf("  %2s%6s %5s%8s%9s  %s\n",
-           "valid", "util", "ops", "secs", "Kops", "trace");
+    printf("  %2s%6s%8s%7s %5s%8s%9s  %s\n",
+           "valid", "util", "heapKB", "resKB", "ops", "secs", "Kops", "trace");
     for (i=0; i < n; i++) {
         if (stats[i].valid) {
             switch(stats[i].weight)
@@ -1295,9 +2328,11 @@ static void printresults(int n, stats_t *stats, sum_stats_t *sumstats)
             /* print '--' if util isn't weighted */
             if(stats[i].weight == WNONE || stats[i].weight == WALL
                || stats[i].weight == WUTIL)
-                printf(" %5.0f%%", stats[i].util * 100.0);
+                printf(" %5.0f%%%8.0f%7.0f", stats[i].util * 100.0,
+                       stats[i].heapsize / 1024.0,
+                       stats[i].resident / 1024.0);
             else
-                printf(" %6s", "--");
+                printf(" %6s%8s%7s", "--", "--", "--");
 
             /* print '--' if perf isn't weighted */
             if(stats[i].weight == WNONE || stats[i].weight == WALL
@@ -1322,13 +2357,15 @@ static void printresults(int n, stats_t *stats, sum_stats_t *sumstats)
                 }
         }
         else {
-            printf("%2s%4s %6s%8s%10s%6s %s\n",
+            printf("%2s%4s %6s%8s%7s%8s%10s%6s %s\n",
                    stats[i].weight != 0 ? "*" : "",
                    "no",
                    "-",
                    "-",
                    "-",
                    "-",
+                   "-",
+                   "-",
                    stats[i].filename);
         }
     }
@@ -1342,10 +2379,12 @@ static void printresults(int n, stats_t *stats, sum_stats_t *sumstats)
 
         double util = (sumutil/(double)sum_util_weight)*100.0;
         double tput = (sumsecs==0.0) ? 0 : (sumops/1e3)/sumsecs;
-        printf("%2d %2d  %5.0f%%%8.0f%10.6f%6.0f\n",
+        printf("%2d %2d  %5.0f%%%8s%7s%8.0f%10.6f%6.0f\n",
                sum_util_weight,
                sum_perf_weight,
                util,
+               "",
+               "",
                sumops,
                sumsecs,
                tput);
@@ -1358,7 +2397,9 @@ static void printresults(int n, stats_t *stats, sum_stats_t *sumstats)
         sumstats->tput = tput;
     }
     else {
-        printf("     %8s%10s%6s\n",
+        printf("     %8s%8s%7s%10s%6s\n",
+               "-",
+               "-",
                "-",
                "-",
                "-");
@@ -1412,12 +2453,77 @@ void malloc_error(const trace_t *trace, int opnum, const char *fmt, ...)
     va_end(ap);
 }
 
+/*
+ * api_error - Report an error found by one of the one-time checks
+ */
+void api_error(const char *check, const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+
+    errors++;
+
+    printf("ERROR [%s check]: ", check);
+    vprintf(fmt, ap);
+    putchar('\n');
+
+    va_end(ap);
+}
+
+/*
+ * printfitstats - print the find_fit counts of the last timed run of each
+ *     trace: calls, blocks looked at per call and cycles per block
+ */
+static void printfitstats(int n, stats_t *stats)
+{
+    int i;
+    int any = 0;
+
+    printf("find_fit in the last timed run:\n");
+    printf("%10s%12s%12s%12s  %s\n",
+           "calls", "nodes/call", "cycles/call", "cycles/node", "trace");
+    for (i = 0; i < n; i++) {
+        if (!stats[i].valid || stats[i].fit_calls == 0)
+            continue;
+        any = 1;
+        printf("%10lu%12.2f%12.1f%12.1f  %s\n", stats[i].fit_calls,
+               (double)stats[i].fit_nodes / stats[i].fit_calls,
+               (double)stats[i].fit_cycles / stats[i].fit_calls,
+               stats[i].fit_nodes ?
+               (double)stats[i].fit_cycles / stats[i].fit_nodes : 0.0,
+               stats[i].filename);
+    }
+    if (!any)
+        printf("  (none counted: build mm.c with MMFLAGS=-DMM_FIT_STATS)\n");
+    printf("\n");
+}
+
+/*
+ * printfragstats - print, averaged over the samples of the util run of
+ *     each trace, the share of the heap that is free and the share of the
+ *     free bytes outside the largest free block
+ */
+static void printfragstats(int n, stats_t *stats)
+{
+    int i;
+
+    printf("Fragmentation, mean of %d samples per trace:\n", FRAG_SAMPLES);
+    printf("%8s%8s  %s\n", "free%", "ext%", "trace");
+    for (i = 0; i < n; i++) {
+        if (!stats[i].valid)
+            continue;
+        printf("%7.1f%%%7.1f%%  %s\n", stats[i].frag_free * 100.0,
+               stats[i].frag_ext * 100.0, stats[i].filename);
+    }
+    printf("\n");
+}
+
 /*
  * usage - Explain the command line arguments
  */
 static void usage(void)
 {
-    fprintf(stderr, "Usage: mdriver [-hlVdD] [-f <file>]\n");
+    fprintf(stderr, "Usage: mdriver [-hlVdDpuT] [-f <file>]\n");
     fprintf(stderr, "Options\n");
     fprintf(stderr, "\t-d <i>     Debug: 0 off; 1 default; 2 lots.\n");
     fprintf(stderr, "\t-D         Equivalent to -d2.\n");
@@ -1428,5 +2534,10 @@ static void usage(void)
     fprintf(stderr, "\t-V         Print diagnostics as each trace is run.\n");
     fprintf(stderr, "\t-v <i>     Set Verbosity Level to <i>\n");
     fprintf(stderr, "\t-s <s>     Timeout after s secs (default no timeout)\n");
+    fprintf(stderr, "\t-g <n>[:<x>] find_fit compares up to n fitting blocks (0: all),\n");
+    fprintf(stderr, "\t           stopping at one within x%% of the request.\n");
+    fprintf(stderr, "\t-T         Time 1, 2, 4 and 8 threads replaying each trace at once.\n");
+    fprintf(stderr, "\t-u         Print free-space fragmentation sampled over each trace.\n");
+    fprintf(stderr, "\t-p         Print find_fit cycles per block visited (needs -DMM_FIT_STATS).\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
 }
@@ -3,6 +3,7 @@
  *						allows us to interleave calls from the student's malloc package 
  *						with the system's malloc package in libc.
  */
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
@@ -12,6 +13,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <pthread.h>
 
 #include "memlib.h"
 #include "config.h"
@@ -20,12 +22,45 @@
 static char *heap;
 static char *mem_brk;
 static char *mem_max_addr;
+static char *mem_clean;			/* heap bytes from here up read as zero */
+static char *mem_sbrk_hi;		/* highest break sbrk() was called for */
+
+/* Records one region handed out by mem_mmap */
+typedef struct mapping_t {
+	char *lo;					/* start of the region */
+	size_t len;					/* length in bytes */
+	struct mapping_t *next;		/* next list element */
+} mapping_t;
+
+static mapping_t *mappings;		/* every live mem_mmap region */
+static size_t mapped_bytes;		/* total length of mappings */
+static size_t mem_peak;			/* high-water mark of heap + mappings */
+
+/* Held while the heap is set up, reset or torn down, see mem_hold */
+static pthread_mutex_t mem_lock = PTHREAD_MUTEX_INITIALIZER;
+/* Guards mappings, mapped_bytes and mem_peak, and writes of mem_brk, as
+   mem_mmap and friends may run alongside mem_sbrk. mem_heap_hi and
+   mem_heapsize read mem_brk atomically instead, since a scavenger thread
+   may trim the heap while the driver looks at it */
+static pthread_mutex_t map_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * update_peak - record a new high-water mark of the memory in use.
+ *		Caller holds map_lock.
+ */
+static void update_peak(void) {
+	size_t in_use = (size_t)(mem_brk - heap) + mapped_bytes;
+	if (in_use > mem_peak)
+		mem_peak = in_use;
+}
 
 /* 
  * mem_init - initialize the memory system model
  */
 void mem_init(void){
 	int dev_zero = open("/dev/zero", O_RDWR);
+
+	pthread_mutex_lock(&mem_lock);
 	heap = mmap((void *)0x800000000, /* suggested start*/
 			MAX_HEAP,				/* length */
 			PROT_WRITE,				/* permissions */
@@ -34,42 +69,325 @@ void mem_init(void){
 			0);						/* offset (dunno) */
 	mem_max_addr = heap + MAX_HEAP;
 	mem_brk = heap;					/* heap is empty initially */
+	mem_clean = heap;
+	mem_sbrk_hi = heap;
+	pthread_mutex_unlock(&mem_lock);
 }
 
 /* 
  * mem_deinit - free the storage used by the memory system model
  */
 void mem_deinit(void){
+	pthread_mutex_lock(&mem_lock);
+	mem_unmap_all();
 	munmap(heap, MAX_HEAP);
+	heap = mem_brk = mem_clean = mem_sbrk_hi = NULL; /* until mem_init */
+	pthread_mutex_unlock(&mem_lock);
 }
 
 /*
  * mem_reset_brk - reset the simulated brk pointer to make an empty heap
  */
 void mem_reset_brk(){
+	pthread_mutex_lock(&mem_lock);
+	pthread_mutex_lock(&map_lock);
 	mem_brk = heap;
+	mem_peak = mapped_bytes;
+	pthread_mutex_unlock(&map_lock);
+	pthread_mutex_unlock(&mem_lock);
+}
+
+/*
+ * mem_hold - keep mem_init, mem_deinit and mem_reset_brk from running
+ *		until mem_release, for a thread that walks the heap on its own
+ *		schedule (the scavenger) rather than from a call of the driver.
+ *		The heap can still grow and shrink through mem_sbrk meanwhile.
+ */
+void mem_hold(void) {
+	pthread_mutex_lock(&mem_lock);
+}
+
+/*
+ * mem_release - undo mem_hold
+ */
+void mem_release(void) {
+	pthread_mutex_unlock(&mem_lock);
 }
 
 /* 
  * mem_sbrk - simple model of the sbrk function. Extends the heap 
- *		by incr bytes and returns the start address of the new area. In
- *		this model, the heap cannot be shrunk.
+ *		by incr bytes and returns the start address of the new area. A
+ *		negative incr shrinks the heap, and the whole pages it gives up
+ *		go back to the OS, so they read as zero if the heap grows again.
+ *		Unlike a real sbrk, growing back over bytes that an earlier heap
+ *		(before mem_reset_brk) used does not clear them, see mem_heap_clean.
+ *		The real sbrk() is only called past the highest break since
+ *		mem_init, so a heap that shrinks and regrows reuses what it got.
  */
 void *mem_sbrk(int incr) {
 	char *old_brk = mem_brk;
+	size_t pagesize = mem_pagesize();
+	char *lo, *hi;
+
+	if (incr < 0) {
+		if (mem_brk + incr < heap) {
+			errno = EINVAL;
+			fprintf(stderr, "ERROR: mem_sbrk failed. Shrunk below the heap...\n");
+			return (void *)-1;
+		}
+		// the real break may hold libc's memory by now, leave it alone
+		pthread_mutex_lock(&map_lock);
+		__atomic_store_n(&mem_brk, mem_brk + incr, __ATOMIC_RELAXED);
+		pthread_mutex_unlock(&map_lock);
+		lo = (char *)(((size_t)mem_brk + pagesize - 1) & ~(pagesize - 1));
+		hi = (char *)((size_t)old_brk & ~(pagesize - 1));
+		if (lo < hi) {
+			madvise(lo, hi - lo, MADV_DONTNEED);
+			// clear the partial page too, so everything from lo up is zero
+			if (mem_clean <= old_brk) {
+				memset(hi, 0, old_brk - hi);
+				mem_clean = lo;
+			}
+		}
+		return (void *)old_brk;
+	}
 
     // call sbrk() in an attempt to have similar semantics as a real allocator.
-	if ( (incr < 0) || ((mem_brk + incr) > mem_max_addr) ||
-            sbrk(incr) == (void *) -1) {
+	if (((mem_brk + incr) > mem_max_addr) ||
+            (mem_brk + incr > mem_sbrk_hi &&
+             sbrk(mem_brk + incr - mem_sbrk_hi) == (void *) -1)) {
 		errno = ENOMEM;
 		fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
 		return (void *)-1;
 	}
+	if (mem_brk + incr > mem_sbrk_hi)
+		mem_sbrk_hi = mem_brk + incr;
 
-	mem_brk += incr;
+	pthread_mutex_lock(&map_lock);
+	__atomic_store_n(&mem_brk, mem_brk + incr, __ATOMIC_RELAXED);
+	update_peak();
+	pthread_mutex_unlock(&map_lock);
+	// the caller may write anything below the new break, see mem_heap_clean
+	if (mem_brk > mem_clean)
+		mem_clean = mem_brk;
 	return (void *)old_brk;
 }
 
+/*
+ * mem_mmap - model of an anonymous mmap of len bytes, outside the heap.
+ *		Returns the page-aligned, zeroed region, or (void *)-1.
+ */
+void *mem_mmap(size_t len) {
+	mapping_t *m;
+	char *p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if (p == MAP_FAILED || (m = malloc(sizeof(mapping_t))) == NULL) {
+		if (p != MAP_FAILED)
+			munmap(p, len);
+		errno = ENOMEM;
+		fprintf(stderr, "ERROR: mem_mmap failed. Ran out of memory...\n");
+		return (void *)-1;
+	}
+	m->lo = p;
+	m->len = len;
+	pthread_mutex_lock(&map_lock);
+	m->next = mappings;
+	mappings = m;
+	mapped_bytes += len;
+	update_peak();
+	pthread_mutex_unlock(&map_lock);
+	return p;
+}
+
+/*
+ * find_mapping - return the link that points to the mapping starting at p.
+ *		Caller holds map_lock.
+ */
+static mapping_t **find_mapping(void *p) {
+	mapping_t **mp;
+
+	for (mp = &mappings; *mp != NULL; mp = &(*mp)->next) {
+		if ((*mp)->lo == p)
+			return mp;
+	}
+	return NULL;
+}
+
+/*
+ * mem_munmap - unmap a whole region returned by mem_mmap/mem_mremap.
+ *		Returns 0 on success, -1 if p is not such a region.
+ */
+int mem_munmap(void *p, size_t len) {
+	mapping_t **mp;
+	mapping_t *m;
+
+	pthread_mutex_lock(&map_lock);
+	mp = find_mapping(p);
+	if (mp == NULL || (*mp)->len != len) {
+		pthread_mutex_unlock(&map_lock);
+		errno = EINVAL;
+		return -1;
+	}
+	m = *mp;
+	*mp = m->next;
+	mapped_bytes -= m->len;
+	pthread_mutex_unlock(&map_lock);
+	munmap(m->lo, m->len);
+	free(m);
+	return 0;
+}
+
+/*
+ * mem_mremap - resize a region returned by mem_mmap/mem_mremap, moving it
+ *		if needed. Returns the new start, or (void *)-1 (and the region
+ *		is left as it was).
+ */
+void *mem_mremap(void *p, size_t oldlen, size_t newlen) {
+	mapping_t **mp;
+	mapping_t *m;
+	char *newp;
+
+	// out of the list while it moves, like mm.c does with its own list
+	pthread_mutex_lock(&map_lock);
+	mp = find_mapping(p);
+	if (mp == NULL || (*mp)->len != oldlen) {
+		pthread_mutex_unlock(&map_lock);
+		errno = EINVAL;
+		return (void *)-1;
+	}
+	m = *mp;
+	*mp = m->next;
+	pthread_mutex_unlock(&map_lock);
+
+	newp = mremap(p, oldlen, newlen, MREMAP_MAYMOVE);
+	if (newp != MAP_FAILED) {
+		m->lo = newp;
+		m->len = newlen;
+	}
+	pthread_mutex_lock(&map_lock);
+	m->next = mappings;
+	mappings = m;
+	if (newp != MAP_FAILED) {
+		mapped_bytes = mapped_bytes - oldlen + newlen;
+		update_peak();
+	}
+	pthread_mutex_unlock(&map_lock);
+	return newp == MAP_FAILED ? (void *)-1 : newp;
+}
+
+/*
+ * mem_unmap_all - unmap every region, as if the process started over
+ */
+void mem_unmap_all(void) {
+	mapping_t *m;
+
+	pthread_mutex_lock(&map_lock);
+	while ((m = mappings) != NULL) {
+		mappings = m->next;
+		munmap(m->lo, m->len);
+		free(m);
+	}
+	mapped_bytes = 0;
+	mem_peak = (size_t)(mem_brk - heap);
+	pthread_mutex_unlock(&map_lock);
+}
+
+/*
+ * mem_is_mapped - return whether [lo, hi] lies inside one mapped region
+ */
+int mem_is_mapped(const void *lo, const void *hi) {
+	mapping_t *m;
+	int found = 0;
+
+	pthread_mutex_lock(&map_lock);
+	for (m = mappings; m != NULL && !found; m = m->next) {
+		if ((const char *)lo >= m->lo && (const char *)hi < m->lo + m->len)
+			found = 1;
+	}
+	pthread_mutex_unlock(&map_lock);
+	return found;
+}
+
+/*
+ * mem_mapsize - returns the number of bytes currently mapped
+ */
+size_t mem_mapsize(void) {
+	return mapped_bytes;
+}
+
+/*
+ * mem_peaksize - returns the high-water mark of heap plus mapped bytes
+ *		since the last mem_reset_brk
+ */
+size_t mem_peaksize(void) {
+	return mem_peak;
+}
+
+/*
+ * mem_purge - model of madvise(MADV_DONTNEED) on the page-aligned heap
+ *		range [p, p+len): its pages stop being resident and read as zero
+ *		when next touched. Returns 0 on success, -1 if the range is not
+ *		whole pages inside the heap.
+ */
+int mem_purge(void *p, size_t len) {
+	size_t pagesize = mem_pagesize();
+
+	if ((char *)p < heap || (char *)p + len > mem_brk ||
+			((size_t)p | len) & (pagesize - 1)) {
+		errno = EINVAL;
+		return -1;
+	}
+	return madvise(p, len, MADV_DONTNEED);
+}
+
+/*
+ * resident_bytes - number of resident bytes among the len bytes at the
+ *		page-aligned address lo
+ */
+static size_t resident_bytes(char *lo, size_t len) {
+	size_t pagesize = mem_pagesize();
+	size_t npages = (len + pagesize - 1) / pagesize;
+	size_t count = 0;
+	unsigned char *vec;
+
+	if (npages == 0 || (vec = malloc(npages)) == NULL)
+		return 0;
+	if (mincore(lo, len, vec) == 0) {
+		for (size_t i = 0; i < npages; i++)
+			count += vec[i] & 1;
+	}
+	free(vec);
+	return count * pagesize;
+}
+
+/*
+ * mem_resident - returns the number of heap and mapped bytes that are
+ *		resident in physical memory
+ */
+size_t mem_resident(void) {
+	size_t total = resident_bytes(heap, mem_heapsize());
+	mapping_t *m;
+
+	pthread_mutex_lock(&map_lock);
+	for (m = mappings; m != NULL; m = m->next)
+		total += resident_bytes(m->lo, m->len);
+	pthread_mutex_unlock(&map_lock);
+	return total;
+}
+
+/*
+ * mem_heap_clean - return the lowest address from which the heap reads as
+ *		zero, up to MAX_HEAP. It is the high-water mark of the break
+ *		since those bytes were last cleared, so it may lie above the
+ *		break after a mem_reset_brk. Growing the heap raises it to the
+ *		new break, so a caller that wants to know which of the new bytes
+ *		are zero reads it before calling mem_sbrk.
+ */
+void *mem_heap_clean(void) {
+	return (void *)mem_clean;
+}
+
 /*
  * mem_heap_lo - return address of the first heap byte
  */
@@ -81,14 +399,16 @@ void *mem_heap_lo(){
  * mem_heap_hi - return address of last heap byte
  */
 void *mem_heap_hi(){
-	return (void *)(mem_brk - 1);
+	return (void *)(__atomic_load_n(&mem_brk, __ATOMIC_RELAXED) - 1);
 }
 
 /*
  * mem_heapsize() - returns the heap size in bytes
  */
 size_t mem_heapsize() {
-	return (size_t)((void *)mem_brk - (void *)heap);
+	char *brk = __atomic_load_n(&mem_brk, __ATOMIC_RELAXED);
+
+	return (size_t)(brk - heap);
 }
 
 /*
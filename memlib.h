@@ -4,8 +4,21 @@ void mem_init(void);
 void mem_deinit(void);
 void *mem_sbrk(int incr);
 void mem_reset_brk(void); 
+void mem_hold(void);
+void mem_release(void);
 void *mem_heap_lo(void);
 void *mem_heap_hi(void);
+void *mem_heap_clean(void);
 size_t mem_heapsize(void);
 size_t mem_pagesize(void);
 
+void *mem_mmap(size_t len);
+int mem_munmap(void *p, size_t len);
+void *mem_mremap(void *p, size_t oldlen, size_t newlen);
+void mem_unmap_all(void);
+int mem_is_mapped(const void *lo, const void *hi);
+size_t mem_mapsize(void);
+size_t mem_peaksize(void);
+int mem_purge(void *p, size_t len);
+size_t mem_resident(void);
+
@@ -10,19 +10,97 @@
  * to heap_start. 
  *
  * For block sizes smaller than 64, there are single bins for each list
- * For block sizes greater than or equal to 64, there are bins for each 
- * power of 2, up to 8192. Any block with size greater than 8192 goes into 
- * one list.
+ * For block sizes greater than or equal to 64, each power of 2 up to 8192 is
+ * split into 4 equal sub-bins (log-linear classes, as in TLSF), so a bin
+ * never spans more than a quarter of its power of 2. getBin computes the
+ * class with one count-leading-zeros. Any block with size greater than 8192
+ * goes into the last bin, which is not a list but a treap (a binary search
+ * tree that is kept balanced by heap-ordering the nodes on a hash of their
+ * address).
+ * Tree nodes are keyed on (size, address), so best fit for a large request
+ * is a single root-to-leaf walk instead of a scan of every large block.
  * 
+ * Alongside the bins, bin_map keeps one bit per bin that is set iff the bin
+ * is non-empty. insertAtRoot sets the bit and join clears it when the last
+ * block of a bin is unlinked, so find_fit can jump straight to the next
+ * non-empty bin with a single count-trailing-zeros.
+ *
+ * Compiling with -DMM_TLSF selects a two-level segregated fit engine
+ * instead, for bounded worst-case malloc time. Blocks, boundary tags,
+ * coalescing and the 4-byte list links are the same, only the bins change:
+ *   - getBin maps a size to a first level (its power of 2) and a second
+ *     level (the next SL_BITS bits), FL_COUNT x SL_COUNT lists in all,
+ *     with exact lists for sizes below 2^FL_SHIFT. There is no tree bin.
+ *   - fl_map has a bit per non-empty first level, sl_map[fl] a bit per
+ *     non-empty list in it.
+ *   - find_fit checks the head of asize's own list, then rounds asize up
+ *     to the next list boundary, where every block fits, and takes the
+ *     head of the first non-empty list at or above it with two
+ *     count-trailing-zeros. malloc and free never scan a list.
+ *
+ * Compiling with -DMM_OOB_BINS keeps the list bins out of band: instead
+ * of links inside the free blocks, each list bin is a vector of (offset,
+ * size) descriptors in oob_area, a mapping of its own, so find_fit scans
+ * contiguous memory and reads no heap block but the one it returns.
+ *
+ * oob_area        : | bin 0: off size | off size ... | bin 1: ... | ...
+ * free block      : | size palloc 0 | index | ... | size 0 |
+ *
+ * A free block keeps the index of its descriptor in its first word, so
+ * removeBlk moves the bin's last descriptor into the hole in O(1) (and
+ * writes the moved block's index). find_fit scans a vector from its end,
+ * so the newest block is still found first. A bin that fills up doubles
+ * into the free space at the end of oob_area; when there is none, every
+ * bin is copied into a new mapping twice the size of their capacities.
+ * If that mapping cannot be had, the block goes on oob_spill instead, a
+ * list linked through the second word of each block (the first says
+ * UNBINNED), which find_fit searches when no bin has a fit.
+ * The tree bin, whose blocks are few and big, stays a treap. Not
+ * available with -DMM_TLSF, which never scans a list.
+ *
+ * Compiling with -DMM_ADDR_ORDER keeps every list bin in address order
+ * instead of LIFO, for address-ordered first fit. Each bin is a treap
+ * keyed on the block address alone, with the same left and right slots
+ * as the tree bin but no parent, so a 16-byte block still holds a node:
+ * addrInsert walks down from the bin head while the nodes outrank bp and
+ * splits the rest of the path around it, addrRemove walks down to bp by
+ * address and merges its subtrees in its place. Both are O(log n) and
+ * read no block header. find_fit takes the lowest-addressed block that
+ * fits in the first bin that has one (addrFit, an in-order walk); a
+ * block that grows in place keeps its address, so coalesce never has to
+ * move it within its bin. Not available with -DMM_TLSF or -DMM_OOB_BINS.
+ *
  * On a call to malloc, size is adjusted to account for padding and overhead.
- * This is done by rounding up to the nearest multiple of 8 and adding an
- * additional 4 bytes for header. find_fit is called on the adjusted 
- * size (asize). find_fit is a best-fit search that works as follows:
- *   - Scan each bin starting from the correct bin for a block of at least
- *     asize bytes
- *   - if we find a perfect fit, return immediately
- *   - Otherwise, return the best fit in the first non-empty bin.
+ * This is done by adding 4 bytes for the header and rounding up to the
+ * nearest multiple of ALIGNMENT (8). find_fit is called on the adjusted 
+ * size (asize). find_fit is a first-fit search over the bins, which are
+ * narrow enough for that to be close to best fit:
+ *   - Scan each non-empty bin starting from the correct bin for a block of
+ *     at least asize bytes, and return the first one
+ *   - Only the correct bin can hold blocks smaller than asize; in any bin
+ *     above it the first block fits
+ *   - The tree bin returns its best fit
+ * How far a bin is searched is a policy, set with mm_fit_policy (or
+ * -DFIT_BUDGET/-DFIT_SLACK): find_fit compares up to fit_budget blocks
+ * that fit and takes the smallest, but stops at the first one that wastes
+ * at most fit_slack percent of asize. The default budget of 1 is first
+ * fit; 0 compares every fitting block in the bin (best fit).
+ * A list walk prefetches the next block's header while it checks the
+ * current one, and the tree walk prefetches both children of a node
+ * before it picks one (-DMM_NO_PREFETCH turns this off, to compare).
+ * With -DMM_FIT_STATS, fit_blk counts find_fit calls and their cycles,
+ * and find_fit the blocks it looks at; mm_fit_stats reports them, and
+ * mdriver -p prints cycles per block visited for each trace.
  * 
+ * The free block right before the epilogue, if there is one, is the
+ * wilderness (wild) and sits in no bin, so find_fit never carves it up
+ * while some other block fits. fit_blk falls back on it only when
+ * find_fit fails, and when it is too small the heap grows by the
+ * shortfall (at least CHUNKSIZE bytes for small requests), which coalesce
+ * merges into it. insertBlk recognizes the last block by its end and
+ * makes it the wilderness instead of binning it, and removeBlk gives it
+ * up, so the rest of the allocator need not know about it.
+ *
  * place is then called on the best-fit block. This decides whether to split,
  * or simply to return. When we split, we remove the current block from its
  * corresponding bin, and place the new free block in its corresponding bin.
@@ -40,6 +118,25 @@
  * next_free and prev_free are stored as offsets from the beginning of the heap
  * which is guaranteed to be < 2^32. This enables us to use 4-byte pointers.
  * As such, the minimum block size is 16: 8 for hdr/ftr, 8 for next/prev.
+ *
+ * Compiling with -DMM_ALIGN16 makes ALIGNMENT 16, the alignment of
+ * max_align_t on x86-64. Block sizes become multiples of 16 and every
+ * header sits in the last 4 bytes of a 16-byte unit, right before its
+ * payload, so the layout above is unchanged: a block still costs 4 bytes
+ * of header, MINSIZE is still 16, and only the size rounding changes.
+ * PROLOGUE_PAD bytes in front of the prologue put the bins on a 16-byte
+ * boundary (heap_start stays at the start of the heap), and the prologue
+ * block is rounded up to PROLOGUE_SIZE, a multiple of 16, with a gap
+ * between bin_end and its footer, so the first payload lands on one too.
+ * The bins for sizes that are not multiples of 16 simply stay empty.
+ *
+ * Blocks in the tree bin reuse the same slots for their children and add
+ * a parent offset after them:
+ *
+ * tree block      : | size palloc 0 | left | right | parent | stuff | size 0 |
+ *
+ * The root's parent is the tree bin itself, and the bin's next slot holds the
+ * root, so the bin looks empty/non-empty exactly like a list bin does.
  * 
  * On a call to free, we reset the header and footer, then call coalesce
  * Coalesce inserts the new free block into the root of the corresponding 
@@ -48,17 +145,187 @@
  * Coalesce is called immedately and not deferred.
  * 
  * Realloc is a wrapper around malloc that reallocs in place if possible
- * i.e. size <= size(block), otherwise mallocs a new block
+ * i.e. size <= size(block), or if the block can grow forward (growBlk):
+ * by absorbing the next block when it is free, and by extending the heap by
+ * exactly the shortfall when the block, or that free block, is the last one
+ * before the epilogue. Failing that, if the previous block is free (its
+ * palloc bit is 0) and previous + current (+ next, if free) is big enough,
+ * they are merged and the payload is moved down with memmove (mergePrevBlk).
+ * Otherwise it mallocs a new block
+ *
+ * Memalign (and posix_memalign, aligned_alloc) asks fit_blk for a free
+ * block of asize + alignment + MINSIZE bytes, which always holds an aligned
+ * payload of asize bytes either at its start or at least MINSIZE bytes in.
+ * The fragment in front of the payload goes back to the bins as a free
+ * block of its own, and place splits off the rest as usual (alignBlk).
+ * Huge requests are mapped as usual when the mapping's payload offset is
+ * aligned enough.
+ *
+ * malloc_batch allocates n blocks of one size with a single fit_blk and
+ * place for n times their size, then writes the n headers into it. The
+ * last block keeps whatever slack place did not split off. free_batch
+ * sorts its pointers by address, turns each run of neighbouring blocks
+ * into one free block and coalesces that once.
+ *
+ * An arena (mm_arena_create) hands out memory with a bump pointer from
+ * chunks of ARENA_CHUNK bytes that are ordinary heap blocks, and
+ * mm_arena_destroy frees the chunks, not the objects. The arena's own
+ * fields sit at the start of its first chunk, and each chunk starts with a
+ * link to the chunk before it:
+ *
+ * arena chunk     : | hdr | link | (arena) | objects ... | free space |
+ *
+ * Objects of more than ARENA_CHUNK/4 bytes get a chunk of their own, which
+ * is linked in behind the newest chunk so its bump space is not given up.
+ * An arena is not locked; use one per thread (or per request).
  *
- * Calloc is the same as in mm-naive
+ * A pool (mm_pool_create) hands out slots of one object size with no
+ * header at all, from slabs of POOL_SLAB bytes that are heap blocks taken
+ * with alloc_blk, laid out like arena chunks with the pool in the first
+ * one. Slots are rounded to a multiple of WSIZE only, so 8- and 12-byte
+ * objects take 8 and 12 bytes (a slot is as aligned as its size allows,
+ * up to ALIGNMENT). A free slot holds the offset of the next free slot,
+ * like the bin links do, so alloc and free are a pop and a push. Slots
+ * that were never used are bumped from the newest slab instead of being
+ * threaded onto the free list up front. mm_pool_destroy frees the slabs.
+ * Pools are not locked either, and neither pools nor arenas survive
+ * mm_init.
+ *
+ * Calloc skips the memset where it can. Every heap byte from zero_lo up is
+ * zero, but for the header, links and footer of the free block that holds
+ * them (there is one such block at most: the last one). zero_lo only moves
+ * up as blocks are allocated or grown over it (place, growBlk,
+ * mergePrevBlk), as a merge buries the links of a block inside a bigger
+ * one (coalesce), or as the heap grows over bytes that memlib does not
+ * know to be zero (grow_heap, mem_heap_clean), and down when the heap is
+ * trimmed. So calloc only clears the payload below zero_lo, plus those few
+ * words. A mapped block is zero already.
+ *
+ * When free leaves a free block of more than trim_threshold bytes right
+ * before the epilogue, the heap is trimmed: the block is cut down to
+ * TRIM_PAD bytes and the rest is handed back with a negative mem_sbrk.
+ * If the heap then has to grow again, that trim was premature, so
+ * grow_heap doubles trim_threshold (starting from TRIM_THRESHOLD). A
+ * heap that spikes once shrinks back, one that keeps cycling soon stops
+ * paying for trimming. mm_trim(pad) trims on demand, whatever the size.
+ *
+ * Free blocks of at least PURGE_MIN bytes that cannot be trimmed give their
+ * pages back in place instead. Every such block carries a stamp after its
+ * links, the value of purge_clock when it was last put in a bin (or made
+ * the wilderness), and purge_clock ticks once per free. Every
+ * PURGE_INTERVAL ticks, purge_scan walks the bins and the wilderness
+ * (which stays whenever it is below the trim threshold) and purges the
+ * blocks that have been free for more than PURGE_DECAY ticks: the whole
+ * pages between the stamp and the footer go to mem_purge
+ * (madvise(MADV_DONTNEED)) and the stamp becomes PURGED. The
+ * blocks stay in their bins, and a block that is reused before it decays
+ * is never purged. Counting frees rather than time keeps runs repeatable.
+ *
+ * free block >= PURGE_MIN : | hdr | next | prev | parent | stamp | ... | ftr |
+ *
+ * Compiling with -DMM_SCAVENGER (which implies -DMM_THREADSAFE) moves both
+ * trimming and purging off the free path, which then makes no syscalls.
+ * A scavenger thread, started by the first mm_init, wakes every
+ * SCAVENGE_MS and ticks purge_clock, so PURGE_DECAY counts its passes
+ * instead of frees. Each pass trims the top of the heap under heap_lock,
+ * then hands the decayed blocks over to itself: under the lock they leave
+ * their bins and are marked allocated, the madvise calls run without the
+ * lock, and the blocks are freed again under it. malloc and free never
+ * wait for a purge.
+ *
+ * With -DMM_SLAB, requests of at most SLAB_MAX bytes (56, or 48 with
+ * -DMM_ALIGN16) do not get blocks of their own but slots in slab pages
+ * (a "big bag of pages"). A slab is a SLAB_SIZE-aligned page (512 bytes
+ * by default, -DSLAB_SHIFT=<log2> to change it), the payload of one
+ * allocated heap block (alignBlk) of SLAB_SIZE bytes, so the next block's
+ * header fits in its last word and slabs pack back to back. A slab holds
+ * slots of a single size class with no header at all; the per-page
+ * metadata sits at the start of the page:
+ *
+ * slab page       : | next | prev | size used free bump | slot | slot | ...
+ *
+ * slab_map has a bit per page of the heap, set iff the page is a slab, so
+ * free, realloc etc. tell a slot from a block by its page (isSlab) before
+ * they read anything in front of it. Free slots hold the in-page offset
+ * of the next free slot, and slots that were never used are bumped off
+ * the end, so slab alloc and free are O(1) and free never coalesces.
+ * slab_lists[class] links the slabs that have a free slot. A slab that
+ * empties goes back to the heap, unless it is the only one on its list.
+ * Slabs are off by default: the driver traces allocate so few small
+ * blocks of each size that a partly used page per class costs more than
+ * the headers it saves (86% against 89% average utilization with 512-byte
+ * pages, less with bigger ones), though malloc and free of small blocks
+ * get faster. Slabs cannot be combined with -DMM_THREADSAFE: a slot would
+ * have to be taken under heap_lock, ahead of the thread caches, which
+ * undoes what the caches are for.
+ *
+ * Requests of more than MMAP_THRESHOLD bytes (-DMMAP_THRESHOLD=n to change
+ * it) do not touch the heap. Each gets its own mapping from mem_mmap, which
+ * free hands straight back with mem_munmap, so a huge block never strands
+ * heap memory after it is freed:
+ *
+ * mapped block    : | len | next | prev | pad | MAPPED 1 | data |
+ *
+ * The header word right before the payload has size 0 and the MAPPED bit
+ * (0x4) set, which free and realloc test before anything else. len is the
+ * length of the mapping, and next/prev link every mapped block into
+ * mmap_list (as real pointers, since mappings lie outside the heap), so
+ * mm_checkheap can find them. realloc resizes a mapped block with
+ * mem_mremap, which may move it but never copies it in user space.
+ * Under -DMM_THREADSAFE mmap_list has a lock of its own, map_lock, held
+ * only to link or unlink a block; the mapping calls themselves take no
+ * lock in mm.c, so huge blocks never wait for heap_lock.
+ *
+ * Compiling with -DMM_THREADSAFE (make MMFLAGS=-DMM_THREADSAFE) makes the
+ * allocator safe to call from several threads. All of the state above is
+ * then guarded by heap_lock, and each thread keeps a cache (tcache) of
+ * blocks up to TCACHE_MAX bytes, one singly linked stack per block size.
+ * Cached blocks stay marked allocated in the heap, so the heap invariants
+ * do not change. malloc and free of small blocks only touch the calling
+ * thread's cache; the lock is taken when a cache bin has to be refilled
+ * (TCACHE_FILL blocks at a time) or flushed (half of it, once it holds more
+ * than TCACHE_COUNT blocks), and for larger blocks. A thread's cache is
+ * flushed when the thread exits. mm_init must not race with other calls;
+ * it bumps heap_gen, which makes every cache drop its now stale blocks.
+ * The owner of an allocated block reads its size without the lock; other
+ * threads only ever flip the palloc bit of that header, never the size.
+ * Both sides go through atomic loads and stores (GET_SHARED/PUT_SHARED),
+ * and the caches load heap_gen atomically too, so none of this races.
+ *
+ * Frees never wait for heap_lock. Blocks that have to go back to the heap
+ * (large blocks and cache flushes) are pushed onto remote_frees, a
+ * lock-free stack linked through the payload that any thread can push a
+ * whole chain onto with one compare-and-swap. The freeing thread drains
+ * the stack itself if the lock is free; otherwise the thread holding it
+ * does as it unlocks (UNLOCK checks remote_frees after releasing the lock
+ * and drains with a trylock), so no free waits for a later malloc. A
+ * drain takes the entire stack with one exchange and coalesces it in a
+ * batch. There is one stack, not one per owning thread: a block outside
+ * the caches belongs to the shared heap rather than to a thread, and only
+ * the heap_lock holder may coalesce it, so per-thread queues would still
+ * be drained by that one holder. The price is that every freeing thread
+ * compare-and-swaps the same head word, so its cache line moves between
+ * CPUs once per push; a push carries a whole chain (a cache flush is
+ * TCACHE_COUNT/2 blocks), which keeps that well below the lock traffic
+ * it replaces.
  *
  * 
  */
 #include <assert.h>
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#if defined(MM_SCAVENGER) && !defined(MM_THREADSAFE)
+#define MM_THREADSAFE
+#endif
+#ifdef MM_THREADSAFE
+#include <pthread.h>
+#endif
+#ifdef MM_SCAVENGER
+#include <time.h>
+#endif
 
 #include "mm.h"
 #include "memlib.h"
@@ -78,13 +345,24 @@
 #define free mm_free
 #define realloc mm_realloc
 #define calloc mm_calloc
+#define memalign mm_memalign
+#define posix_memalign mm_posix_memalign
+#define aligned_alloc mm_aligned_alloc
+#define malloc_usable_size mm_malloc_usable_size
+#define free_sized mm_free_sized
+#define malloc_batch mm_malloc_batch
+#define free_batch mm_free_batch
 #endif /* def DRIVER */
 
-/* single word (4) or double word (8) alignment */
+/* double word (8) alignment, or 16 (max_align_t on x86-64) with -DMM_ALIGN16 */
+#ifdef MM_ALIGN16
+#define ALIGNMENT 16
+#else
 #define ALIGNMENT 8
+#endif
 
 /* rounds up to the nearest multiple of ALIGNMENT */
-#define ALIGN(p) (((size_t)(p) + (ALIGNMENT-1)) & ~0x7)
+#define ALIGN(p) (((size_t)(p) + (ALIGNMENT-1)) & ~(size_t)(ALIGNMENT-1))
 
 #define checkheap(lineno) mm_checkheap(lineno)
 // #define checkheap(lineno) 
@@ -96,8 +374,113 @@
 #define INITSIZE   (4096) /* Initial extension */
 #define CHUNKSIZE  (512)  /* Extend heap by this amount (bytes) */ 
 #define END         heap_start 
+#ifdef MM_TLSF
+#define SL_BITS     3      /* Each power of 2 has 8 second-level lists */
+#define SL_COUNT    (1 << SL_BITS)
+#define FL_SHIFT    (SL_BITS + 3) /* Sizes below 2^FL_SHIFT get exact lists */
+#define FL_COUNT    (32 - FL_SHIFT + 1) /* Block sizes are < 2^32 */
+#define NBINS       (FL_COUNT * SL_COUNT) /* Bins in the prologue */
+#else
+#define SUBBIN_BITS 2      /* Each power of 2 from 64 to 8192 has 4 bins */
+#define NBINS       (6 + (7 << SUBBIN_BITS) + 1) /* Bins in the prologue */
+#endif
+#ifdef MM_OOB_BINS
+#ifdef MM_TLSF
+#error "MM_OOB_BINS needs the segregated list bins, not MM_TLSF"
+#endif
+#define OOB_MINCAP  8      /* Descriptors a list bin gets the first time */
+#define UNBINNED    (~0U)  /* Index of a free block no descriptor was found for */
+#endif
+#if defined(MM_ADDR_ORDER) && (defined(MM_TLSF) || defined(MM_OOB_BINS))
+#error "MM_ADDR_ORDER needs the segregated list bins with in-block links"
+#endif
+#if defined(MM_SLAB) && defined(MM_THREADSAFE)
+#error "MM_SLAB takes heap_lock on every small malloc, use MM_THREADSAFE alone"
+#endif
+#ifndef SLAB_SHIFT
+#define SLAB_SHIFT   9                  /* log2 of the slab page size */
+#endif
+#define SLAB_SIZE    (1 << SLAB_SHIFT) /* Bytes in a slab page */
+#define SLAB_MAX     (64 - ALIGNMENT)  /* Largest request served by slabs */
+#define SLAB_CLASSES (SLAB_MAX / ALIGNMENT) /* Slot sizes ALIGNMENT..SLAB_MAX */
+#define SLAB_PAGES   (1UL << (32 - SLAB_SHIFT)) /* Heap offsets are < 2^32 */
+
+/* Size class of a request of 1..SLAB_MAX bytes */
+#define SLAB_CLASS(size) (((size) - 1) / ALIGNMENT)
+
+/* Prologue block: header, bins and footer, rounded up to ALIGNMENT */
+#define PROLOGUE_SIZE ALIGN((2*NBINS+2)*WSIZE)
+/* Bytes in front of the padding word that put the bins on ALIGNMENT */
+#define PROLOGUE_PAD ((ALIGNMENT - 2*WSIZE) % ALIGNMENT)
+
+#define TCACHE_MAX   256  /* Largest block size kept in thread caches */
+#define TCACHE_BINS  ((TCACHE_MAX - MINSIZE) / ALIGNMENT + 1)
+#define TCACHE_COUNT 32   /* Flush half of a cache bin past this many */
+#define TCACHE_FILL  8    /* Blocks moved into a cache bin per refill */
+
+/* Cache bin for blocks of at least size bytes */
+#define TCACHE_INDEX(size) (((size) - MINSIZE) / ALIGNMENT)
+
+#ifndef MMAP_THRESHOLD
+#define MMAP_THRESHOLD (128*1024) /* Larger requests get their own mapping */
+#endif
+#define MMAP_HDRSIZE 32   /* len, next, prev, pad, header before the payload */
+/* Largest heap block: a header holds 32 bits and mem_sbrk takes an int */
+#define MAX_BLKSIZE  (0x7fffffff & ~(ALIGNMENT-1))
+#define MAX_REQUEST  ((size_t)-1 / 2) /* Larger requests overflow asize */
+#ifndef TRIM_THRESHOLD
+#define TRIM_THRESHOLD (128*1024) /* Initial value of trim_threshold */
+#endif
+#ifndef TRIM_PAD
+#define TRIM_PAD     (TRIM_THRESHOLD/2) /* Free bytes a trim leaves at the top */
+#endif
+#ifdef MM_SCAVENGER
+#ifndef SCAVENGE_MS
+#define SCAVENGE_MS  50   /* Sleep between scavenger passes */
+#endif
+#ifndef PURGE_DECAY
+#define PURGE_DECAY  4    /* Passes a block stays free before it is purged */
+#endif
+#endif
+#ifndef PURGE_DECAY
+#define PURGE_DECAY  4096 /* Frees a block stays free before it is purged */
+#endif
+#define PURGE_INTERVAL (PURGE_DECAY/4) /* Frees between purge passes */
+#define PURGE_MIN    (16*1024) /* Smallest free block that gets purged */
+#define PURGED       0    /* Stamp of a purged block, purge_clock skips it */
+#ifndef ARENA_CHUNK
+#define ARENA_CHUNK  (16*1024) /* Bytes an arena allocates at a time */
+#endif
+/* Bytes at the start of an arena chunk or pool slab that hold its link */
+#define CHUNK_LINK   ALIGN(sizeof(char *))
+#ifndef POOL_SLAB
+#define POOL_SLAB    4096 /* Heap block a pool carves its slots from */
+#endif
+#define POOL_MAX     (POOL_SLAB/8) /* Largest object size a pool takes */
+
+#ifndef FIT_BUDGET
+#define FIT_BUDGET   1    /* Fitting blocks find_fit compares, 0 for no limit */
+#endif
+#ifndef FIT_SLACK
+#define FIT_SLACK    0    /* Waste, in % of the request, that ends the search */
+#endif
 
 #define MAX(x, y) ((x) > (y)? (x) : (y))  
+#define MIN(x, y) ((x) < (y)? (x) : (y))
+
+/* Start loading the cache line at p, a header the walk reads next */
+#ifdef MM_NO_PREFETCH
+#define PREFETCH(p)
+#else
+#define PREFETCH(p)   __builtin_prefetch(p)
+#endif
+
+/* Count a block that find_fit looked at */
+#ifdef MM_FIT_STATS
+#define FIT_NODE()    (fit_nodes++)
+#else
+#define FIT_NODE()
+#endif
 
 /* Pack a size and allocated bit into a word */
 #define PACK(size, alloc)           ((size) | (alloc))
@@ -122,16 +505,43 @@
 #define PUTNPTR(p, val) (*(unsigned int *)(p) = \
                           (unsigned int)((unsigned long)(val) - \
                                          (unsigned long)(END)))
+/* Read and write a header that its owner may read without heap_lock: the
+ * header of an allocated block, whose palloc bit a neighbour can flip */
+#ifdef MM_THREADSAFE
+#define GET_SHARED(p)      __atomic_load_n((unsigned int *)(p), __ATOMIC_RELAXED)
+#define PUT_SHARED(p, val) __atomic_store_n((unsigned int *)(p), (val), \
+                                            __ATOMIC_RELAXED)
+#else
+#define GET_SHARED(p)      GET(p)
+#define PUT_SHARED(p, val) PUT(p, val)
+#endif
 /* read/write allocation state of previous block, require f is either 2 or 0 */
 #define GETPALLOC(p)    (*(unsigned int *)(p) & 0x2)
-#define PUTPALLOC(p, a) (*(unsigned int *)(p) = a ? \
-                           ((*(unsigned int *)(p)) | 0x2) : \
-                           ((*(unsigned int *)(p)) & ~0x2))
+#define PUTPALLOC(p, a) PUT_SHARED(p, a ? (GET_SHARED(p) | 0x2) : \
+                                          (GET_SHARED(p) & ~0x2))
 
 /* Read the size and allocated fields from address p */
 #define GET_SIZE(p)  (GET(p) & ~0x7)                   
 #define GET_ALLOC(p) (GET(p) & 0x1)                    
 
+/* Header bit of blocks that live in their own mapping */
+#define MAPPED        0x4
+#define IS_MAPPED(bp) (GET_SHARED(HDRP(bp)) & MAPPED)
+/* Size of the allocated block bp, read by its owner without heap_lock */
+#define OWN_SIZE(bp)  (GET_SHARED(HDRP(bp)) & ~0x7)
+
+/* Given a mapped block ptr bp, its mapping and the fields at its start */
+#define MAP_BASE(bp)  ((char *)(bp) - MMAP_HDRSIZE)
+#define MAP_LEN(bp)   (*(size_t *)MAP_BASE(bp))
+#define MAP_NEXT(bp)  (*(char **)(MAP_BASE(bp) + DSIZE))
+#define MAP_PREV(bp)  (*(char **)(MAP_BASE(bp) + 2*DSIZE))
+
+/* Purge stamp of a free block of at least PURGE_MIN bytes, after its links */
+#define STAMP(bp)     (*(unsigned int *)((char *)(bp) + 3*WSIZE))
+/* Has free block bp been free for more than PURGE_DECAY ticks? */
+#define DECAYED(bp)   (STAMP(bp) != PURGED && \
+                       purge_clock - STAMP(bp) > PURGE_DECAY)
+
 /* Given block ptr bp, compute address of its header and footer */
 #define HDRP(bp)       ((char *)(bp) - WSIZE)                      
 #define FTRP(bp)       ((char *)(bp) + GET_SIZE(HDRP(bp)) - DSIZE) 
@@ -140,14 +550,170 @@
 #define NEXT_BLKP(bp)  ((char *)(bp) + GET_SIZE(((char *)(bp) - WSIZE)))
 #define PREV_BLKP(bp)  ((char *)(bp) - GET_SIZE(((char *)(bp) - DSIZE)))
 
+/* Read and write the children and parent of a node in the tree bin */
+#define GETLEFT(p)        GETNPTR(p)
+#define GETRIGHT(p)       GETPPTR(p)
+#define GETPARENT(p)      GETNPTR((char *)(p) + DSIZE)
+#define PUTLEFT(p, val)   PUTNPTR(p, val)
+#define PUTRIGHT(p, val)  PUTPPTR(p, val)
+#define PUTPARENT(p, val) PUTNPTR((char *)(p) + DSIZE, val)
+
+/* Treap priority of a tree node, a multiplicative hash of its offset */
+#define PRIORITY(p)    ((unsigned int)((unsigned long)(p) - \
+                                       (unsigned long)(END)) * 2654435761u)
+
+#ifdef MM_TLSF
+/* There is no tree bin, and the treap code is not compiled in */
+#define IS_TREE_BIN(bin) 0
+#else
+/* The last bin holds every block of size >= 8192, as a treap */
+#define TREE_BIN       (heap_listp + (DSIZE*(NBINS-1)))
+#define IS_TREE_BIN(bin) ((bin) == TREE_BIN)
+#endif
+
+#ifdef MM_OOB_BINS
+/* Index of the descriptor of free block bp in its list bin */
+#define DESC_IDX(bp)   (*(unsigned int *)(bp))
+/* Next block on oob_spill after UNBINNED free block bp */
+#define SPILL_NEXT(bp) GETNPTR((char *)(bp) + WSIZE)
+#endif
+
+/* Given bin ptr, compute its index in the prologue (and in bin_map) */
+#define BIN_INDEX(bin) ((unsigned int)(((char *)(bin) - heap_listp) / DSIZE))
+/* Is p one of the bin heads in the prologue? */
+#define IS_BIN(p)      ((char *)(p) >= heap_listp && (char *)(p) < bin_end)
+
 /* Global variables */
 static char *heap_listp = 0;    /* Pointer to first block */
 static char *heap_start = 0;    /* Start of heap, where there is nothing */
 static char *bin_end = 0; /* End of prologue block */
+#ifdef MM_TLSF
+static unsigned int fl_map = 0; /* Bit fl set iff sl_map[fl] != 0 */
+static unsigned int sl_map[FL_COUNT]; /* Bit sl set iff list non-empty */
+#else
+static unsigned long bin_map = 0; /* Bit i set iff bin i is non-empty */
+#endif
+#ifdef MM_OOB_BINS
+/* Descriptor of a free block in a list bin, see the comment at the top */
+typedef struct {
+  unsigned int off;  /* Offset of the block from heap_start */
+  unsigned int size; /* Block size */
+} fdesc_t;
+
+/* The descriptors of a list bin are oob_area[base .. base+len) */
+typedef struct {
+  unsigned int base;
+  unsigned int len;
+  unsigned int cap;
+} fvec_t;
+
+static fvec_t bin_vec[NBINS];    /* By bin index, the tree bin's is unused */
+static fdesc_t *oob_area = NULL; /* Mapping that holds every bin's vector */
+static size_t oob_len = 0;       /* Bytes in oob_area */
+static unsigned int oob_top = 0; /* Descriptors from here up are unused */
+static char *oob_spill = NULL;   /* UNBINNED free blocks, see the top */
+#endif
+static unsigned long heap_gen = 0; /* Bumped by every mm_init */
+static char *mmap_list = NULL; /* Mapped blocks, linked through MAP_NEXT */
+static size_t trim_threshold = TRIM_THRESHOLD; /* See the comment at the top */
+static int auto_trimmed = 0; /* free trimmed the heap since it last grew */
+static unsigned int purge_clock = 1; /* Frees so far, never PURGED */
+static char *zero_lo = 0; /* Heap bytes from here up are zero, see the top */
+static char *wild = NULL; /* Free block before the epilogue, in no bin */
+static unsigned int fit_budget = FIT_BUDGET; /* See find_fit */
+static unsigned int fit_slack = FIT_SLACK;   /* See find_fit */
+#ifdef MM_FIT_STATS
+static unsigned long fit_calls = 0;  /* find_fit calls since mm_init */
+static unsigned long fit_nodes = 0;  /* Blocks they looked at */
+static unsigned long fit_cycles = 0; /* Cycles they took */
+#endif
+
+/* Metadata at the start of a slab page, see the comment at the top */
+typedef struct slab {
+  struct slab *next;  /* Slabs of the same class with a free slot */
+  struct slab *prev;
+  unsigned short size; /* Slot size */
+  unsigned short used; /* Slots handed out */
+  unsigned short free; /* In-page offset of the first free slot, 0 if none */
+  unsigned short bump; /* In-page offset of the first slot never used */
+} slab_t;
+
+/* In-page offset of the first slot */
+#define SLAB_HDR     ALIGN(sizeof(slab_t))
+/* Slots in a slab of slot size size; the page's last word is the header
+   of the next block */
+#define SLAB_SLOTS(size) ((SLAB_SIZE - WSIZE - SLAB_HDR) / (size))
+/* Slab page that slot p is in */
+#define SLAB_OF(p)   ((slab_t *)((unsigned long)(p) & ~(unsigned long)(SLAB_SIZE-1)))
+
+#ifdef MM_SLAB
+static slab_t *slab_lists[SLAB_CLASSES]; /* Slabs with a free slot */
+static unsigned long slab_map[SLAB_PAGES / 64]; /* Bit set iff page is a slab */
+static unsigned long slab_hi = 0; /* slab_map is clear from this word up */
+#endif
+
+/* An arena, at the start of its first chunk, see the comment at the top */
+struct mm_arena {
+  char *chunks; /* Newest chunk, linked to the older ones by its first word */
+  char *cur;    /* Next free byte in the newest chunk */
+  char *end;    /* End of the newest chunk */
+};
+
+/* A pool, at the start of its first slab, see the comment at the top */
+struct mm_pool {
+  size_t size;       /* Slot size */
+  unsigned int free; /* Offset of the first free slot, 0 if there is none */
+  char *slabs;       /* Newest slab, linked to the older ones by its first word */
+  char *cur;         /* Next never-used slot in the newest slab */
+  char *end;         /* End of the newest slab */
+};
+
+#ifdef MM_THREADSAFE
+/* Per-thread cache of small blocks, see the comment at the top */
+typedef struct {
+  char *bins[TCACHE_BINS];          /* Stacks linked through the payload */
+  unsigned int counts[TCACHE_BINS]; /* Number of blocks in each stack */
+  unsigned long gen;                /* heap_gen the blocks belong to */
+  int registered;                   /* Exit destructor installed */
+} tcache_t;
+
+static pthread_mutex_t heap_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t tcache_once = PTHREAD_ONCE_INIT;
+static pthread_key_t tcache_key;
+static __thread tcache_t tcache;
+static char *remote_frees = NULL; /* Blocks waiting for free_blk */
+static pthread_mutex_t map_lock = PTHREAD_MUTEX_INITIALIZER; /* mmap_list */
+
+#ifdef MM_SCAVENGER
+static pthread_mutex_t scavenge_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t scavenger_once = PTHREAD_ONCE_INIT;
+static char *purge_queue; /* Decayed blocks of a pass, linked by STAMP */
+#endif
+
+/* heap_gen, as tcache_get and tcache_put read it without heap_lock */
+#define HEAP_GEN() __atomic_load_n(&heap_gen, __ATOMIC_ACQUIRE)
+
+#define LOCK()   pthread_mutex_lock(&heap_lock)
+#define UNLOCK() heap_unlock()
+#define MAP_LOCK()   pthread_mutex_lock(&map_lock)
+#define MAP_UNLOCK() pthread_mutex_unlock(&map_lock)
+#else
+#define LOCK()
+#define UNLOCK()
+#define MAP_LOCK()
+#define MAP_UNLOCK()
+#endif
 
 /* Function prototypes for internal helper routines */
 // void checkheap(int lineno, unsigned long p);
 static void *extend_heap(size_t words);
+static void *grow_heap(size_t size);
+static int trim_heap(size_t pad);
+static inline void dirtyTo(char *p);
+static void auto_trim(void);
+static void purge_tick(void);
+static void purgeBlk(char *bp);
+static void purge_scan(void (*fn)(char *));
 static void place(void *bp, size_t asize);
 static void *find_fit(size_t asize);
 static void *coalesce(void *bp);
@@ -155,39 +721,144 @@ static inline void coalesceNext(void *bp, size_t size);
 static inline void insertAtRoot(char *bp, char *bin, char *first_blk);
 static inline void join(char *prev, char *next);
 static inline char *getBin(size_t size);
+static inline void insertBlk(char *bp, char *bin);
+static inline void removeBlk(char *bp, char *bin);
+static inline int isLast(char *bp);
+#ifndef MM_TLSF
+static void treeInsert(char *bp);
+static void treeRemove(char *bp);
+static void *treeFit(size_t asize);
+#endif
+#ifdef MM_ADDR_ORDER
+static void addrInsert(char *bp, char *bin);
+static void addrRemove(char *bp, char *bin);
+static char *addrFit(char *bp, size_t asize);
+#endif
 static inline void splitBlk(void *oldptr, size_t asize, size_t csize);
+static int growBlk(void *bp, size_t asize, size_t csize);
+static void *mergePrevBlk(void *bp, size_t asize, size_t csize);
+static void mapLink(char *bp);
+static void mapUnlink(char *bp);
+static void *mapBlk(size_t asize);
+static void unmapBlk(char *bp);
+static void *remapBlk(char *bp, size_t asize);
+#ifdef MM_SLAB
+static inline int isSlab(const void *p);
+static void *slab_alloc(size_t size);
+static void slab_free(void *p);
+#endif
+static int init_heap(void);
+static void *alloc_blk(size_t asize);
+static void *fit_blk(size_t asize);
+static void *alignBlk(size_t asize, size_t alignment);
+static void free_blk(void *ptr);
+static void *arenaGrow(mm_arena_t *arena, size_t size);
+static char *poolSlab(void);
+static void check_heap(int lineno);
+#ifdef MM_SCAVENGER
+static void scavenger_start(void);
+#endif
+#ifdef MM_THREADSAFE
+static void *tcache_get(size_t asize);
+static void tcache_put(void *ptr, size_t size);
+static void remote_free(char *first, char *last);
+static void remote_drain(void);
+static void heap_unlock(void);
+#endif
 
 /*
  * prologue_init: set up prologue by setting header, footer, and each bin's
  * prev and next to END
  */
 void prologue_init(void) {
-  unsigned int hdrSize = 30*WSIZE;
+  unsigned int hdrSize = PROLOGUE_SIZE;
   PUT(heap_listp, 0);                          /* Alignment padding */
   PUT(heap_listp + WSIZE, PACK(hdrSize, 1)); /* Prologue header */
-  for (int i = 2; i < 29; i+=2) {
+  for (int i = 2; i < 2*NBINS+1; i+=2) {
     // pointer to next(epilogue) block
     PUTNPTR(heap_listp + (i*WSIZE), END);
     // pointer to prev block
     PUTPPTR(heap_listp + (i*WSIZE), END);
   }
-  PUT(heap_listp + (30*WSIZE), PACK(hdrSize, 1)); /* Prologue footer */
+  PUT(heap_listp + hdrSize, PACK(hdrSize, 1)); /* Prologue footer */
 }
 
 /*
  * Initialize: return -1 on error, 0 on success.
- * sets up prologue, epilogue, and extends heap for first free block
  */
 int mm_init(void) {
+  int ret;
+
+#ifdef MM_SCAVENGER
+  pthread_mutex_lock(&scavenge_lock);
+#endif
+  LOCK();
+  ret = init_heap();
+  UNLOCK();
+#ifdef MM_SCAVENGER
+  pthread_mutex_unlock(&scavenge_lock);
+#endif
+  return ret;
+}
+
+/*
+ * init_heap - sets up prologue, epilogue, and extends heap for first
+ *             free block
+ */
+static int init_heap(void) {
+  // the caches read heap_gen without heap_lock
+  __atomic_store_n(&heap_gen, heap_gen + 1, __ATOMIC_RELEASE);
+#ifdef MM_SCAVENGER
+  pthread_once(&scavenger_once, scavenger_start);
+#endif
+#ifdef MM_THREADSAFE
+  // anything still queued belongs to the old heap
+  remote_frees = NULL;
+#endif
+  // the caller (e.g. the driver) discards the old mappings with the heap
+  MAP_LOCK();
+  mmap_list = NULL;
+  MAP_UNLOCK();
+#ifdef MM_SLAB
+  memset(slab_lists, 0, sizeof(slab_lists));
+  memset(slab_map, 0, slab_hi * sizeof(*slab_map));
+  slab_hi = 0;
+#endif
+  trim_threshold = TRIM_THRESHOLD;
+  auto_trimmed = 0;
+  purge_clock = 1;
+  wild = NULL;
+#ifdef MM_FIT_STATS
+  fit_calls = fit_nodes = fit_cycles = 0;
+#endif
+
   /* Create the initial empty heap */
-  if ((heap_listp = mem_sbrk(32*WSIZE)) == (void *)-1) 
+  if ((heap_start = mem_sbrk(PROLOGUE_PAD + PROLOGUE_SIZE + 2*WSIZE)) ==
+      (void *)-1)
       return -1;
 
-  heap_start = heap_listp;
+  heap_listp = heap_start + PROLOGUE_PAD;
   prologue_init();
-  PUT(heap_listp + (31*WSIZE), PACKPA(0, 1, 2)); // size 0 to signify end
-  bin_end = heap_listp + (30*WSIZE);
+  // size 0 to signify end
+  PUT(heap_listp + PROLOGUE_SIZE + WSIZE, PACKPA(0, 1, 2));
+  bin_end = heap_listp + ((2*NBINS+2)*WSIZE);
   heap_listp += (2*WSIZE);
+  // nothing has been written past here, grow_heap checks what memlib says
+  zero_lo = (char *)mem_heap_hi() + 1;
+#ifdef MM_TLSF
+  fl_map = 0;
+  memset(sl_map, 0, sizeof(sl_map));
+#else
+  bin_map = 0;
+#endif
+#ifdef MM_OOB_BINS
+  // like mmap_list, the old oob_area went with the old heap
+  memset(bin_vec, 0, sizeof(bin_vec));
+  oob_area = NULL;
+  oob_len = 0;
+  oob_top = 0;
+  oob_spill = END;
+#endif
 
   /* Extend the empty heap with a free block of CHUNKSIZE bytes */
   if (extend_heap(INITSIZE/WSIZE) == NULL)
@@ -201,37 +872,137 @@ int mm_init(void) {
  */
 void *malloc (size_t size) {
   size_t asize;      /* Adjusted block size */
-  size_t extendsize; /* Amount to extend heap if no fit */
   char *bp;      
 
-  if (heap_listp == 0){
-    mm_init();
-  }
-  /* Ignore spurious requests */
-  if (size == 0)
+  /* Ignore spurious requests, and those no block size can hold */
+  if (size == 0 || size > MAX_REQUEST)
     return NULL;
 
   /* Adjust block size to include overhead and alignment reqs. */
   if (size <= 3*WSIZE)                                      
     asize = MINSIZE;                                     
   else
-    asize = DSIZE * ((size + (WSIZE) + (DSIZE-1)) / DSIZE);
-
-  /* Search the free list for a fit */
-  if ((bp = find_fit(asize)) != NULL) {  
-    place(bp, asize);                  
+    asize = ALIGNMENT * ((size + (WSIZE) + (ALIGNMENT-1)) / ALIGNMENT);
+
+#ifdef MM_SLAB
+  // small requests take a slot, or a block if there is no room for a slab
+  if (size <= SLAB_MAX) {
+    LOCK();
+    if ((bp = slab_alloc(size)) == NULL)
+      bp = alloc_blk(asize);
+    UNLOCK();
     return bp;
   }
+#endif
+
+#ifdef MM_THREADSAFE
+  if (asize <= TCACHE_MAX)
+    return tcache_get(asize);
+#endif
+
+  // huge requests get their own mapping, or the heap if mmap fails
+  if (asize > MMAP_THRESHOLD && (bp = mapBlk(asize)) != NULL)
+    return bp;
+  LOCK();
+  bp = alloc_blk(asize);
+  UNLOCK();
+  return bp;
+}
 
-  /* No fit found. Get more memory and place the block */
-  extendsize = MAX(asize,CHUNKSIZE);                 
-  if ((bp = extend_heap(extendsize/WSIZE)) == NULL)  
-    return NULL;                                  
-  place(bp, asize); 
-                               
+/*
+ * alloc_blk - allocate a block of asize bytes, extending the heap if
+ *             no free block fits. Caller holds heap_lock.
+ */
+static void *alloc_blk(size_t asize) {
+  char *bp = fit_blk(asize);
+
+  if (bp != NULL)
+    place(bp, asize);
   return bp;
 }
 
+/*
+ * alignBlk - allocate a block of asize bytes whose payload is a multiple of
+ *            alignment (> ALIGNMENT). Any free block of asize + alignment +
+ *            MINSIZE bytes has such a payload less than alignment + MINSIZE
+ *            bytes in, with either nothing in front of it or a fragment of
+ *            at least MINSIZE bytes, which is split off and binned.
+ *            Caller holds heap_lock.
+ */
+static void *alignBlk(size_t asize, size_t alignment) {
+  char *bp = fit_blk(asize + alignment + MINSIZE);
+  char *abp;
+  size_t csize;
+  size_t lead;
+  unsigned int palloc;
+
+  if (bp == NULL)
+    return NULL;
+  abp = (char *)(((size_t)bp + alignment - 1) & ~(alignment - 1));
+  if (abp != bp && (size_t)(abp - bp) < MINSIZE)
+    abp += alignment;
+
+  if ((lead = abp - bp) != 0) {
+    csize = GET_SIZE(HDRP(bp));
+    palloc = GETPALLOC(HDRP(bp));
+    removeBlk(bp, getBin(csize));
+    PUT(HDRP(bp), PACKPA(lead, 0, palloc));
+    PUT(FTRP(bp), PACK(lead, 0));
+    insertBlk(bp, getBin(lead));
+    // the block after abp already has palloc 0, bp was free
+    PUT(HDRP(abp), PACKPA(csize - lead, 0, 0));
+    PUT(FTRP(abp), PACK(csize - lead, 0));
+    insertBlk(abp, getBin(csize - lead));
+  }
+  place(abp, asize);
+  return abp;
+}
+
+/*
+ * fit_blk - find a free block of at least asize bytes, extending the heap
+ *           if none fits, but do not place it. Caller holds heap_lock.
+ */
+static void *fit_blk(size_t asize) {
+  size_t extendsize; /* Amount to extend heap if no fit */
+  size_t wsize = 0;  /* Size of the wilderness */
+  char *bp;
+
+  if (heap_listp == 0){
+    init_heap();
+  }
+
+#ifdef MM_THREADSAFE
+  // coalesce queued frees first, they may provide the fit
+  remote_drain();
+#endif
+
+  /* Search the free list for a fit */
+#ifdef MM_FIT_STATS
+  unsigned long start = __builtin_ia32_rdtsc();
+  bp = find_fit(asize);
+  fit_cycles += __builtin_ia32_rdtsc() - start;
+  fit_calls++;
+  if (bp != NULL)
+    return bp;
+#else
+  if ((bp = find_fit(asize)) != NULL)
+    return bp;
+#endif
+
+  /* No fit found. Fall back on the wilderness, or grow it */
+  if (wild != NULL) {
+    wsize = GET_SIZE(HDRP(wild));
+    if (wsize >= asize)
+      return wild;
+  }
+  // a large request grows the wilderness by exactly the shortfall
+  extendsize = asize - wsize;
+  if (asize < CHUNKSIZE)
+    extendsize = MAX(extendsize, CHUNKSIZE);
+  extendsize = MAX(extendsize, MINSIZE);
+  return extend_heap(extendsize/WSIZE);
+}
+
 /*
  * free - frees block, coalescing not deferred
  */
@@ -239,148 +1010,1068 @@ void free (void *ptr) {
   if (ptr == 0) 
       return;
 
-  size_t size = GET_SIZE(HDRP(ptr));
-  if (heap_listp == 0){
-    mm_init();
+#ifdef MM_SLAB
+  // a slot has no header, so this goes before anything reads one
+  if (isSlab(ptr)) {
+    LOCK();
+    slab_free(ptr);
+    UNLOCK();
+    return;
   }
+#endif
 
-  unsigned int palloc = GETPALLOC(HDRP(ptr));
-  // update header and footer with previous allocation state
-  PUT(HDRP(ptr), PACKPA(size, 0, palloc));
-  PUT(FTRP(ptr), PACK(size, 0));
-  coalesce(ptr);
-}
+  if (IS_MAPPED(ptr)) {
+    unmapBlk(ptr);
+    return;
+  }
 
+#ifdef MM_THREADSAFE
+  if (OWN_SIZE(ptr) <= TCACHE_MAX) {
+    tcache_put(ptr, OWN_SIZE(ptr));
+  } else {
+    remote_free(ptr, ptr);
+  }
+#else
+  free_blk(ptr);
+#endif
+}
 
 /*
- * realloc - reallocs in place if possible, otherwise allocates new block
+ * free_sized - free a block that was allocated with size bytes (the last
+ *              size passed to malloc, realloc, etc. for it). A block that
+ *              small cannot be mapped, so the header is not read for that,
+ *              and with -DMM_THREADSAFE size alone picks the cache bin.
+ *              Without it, that mapped test is all size saves: place may
+ *              not have split the block, so free_blk reads its size from
+ *              the header anyway. -DDEBUG checks size against the header
  */
-void *realloc(void *oldptr, size_t size) {
-  void *newptr;
+void free_sized(void *ptr, size_t size) {
   size_t asize;
-  size_t oldsize;
 
-  /* If size == 0 then this is just free, and we return NULL. */
-  if(size == 0) {
-    mm_free(oldptr);
-    return 0;
-  }
+  if (ptr == 0)
+    return;
 
-  /* If oldptr is NULL, then this is just malloc. */
-  if(oldptr == NULL) {
-    return mm_malloc(size);
+#ifdef MM_SLAB
+  // a small size does not tell a slot, a block may have shrunk to it
+  if (isSlab(ptr)) {
+    LOCK();
+    slab_free(ptr);
+    UNLOCK();
+    return;
   }
-
-  oldsize = GET_SIZE(HDRP(oldptr));
+#endif
 
   // do a similar thing as malloc
-  if (size <= 3*WSIZE)                                      
-    asize = MINSIZE;                                     
+  if (size <= 3*WSIZE)
+    asize = MINSIZE;
   else
-    asize = DSIZE * ((size + (WSIZE) + (DSIZE-1)) / DSIZE);
-
-  
-  if (asize <= oldsize) {
-    // this means we can simply split the current block or return old block
-    splitBlk(oldptr, asize, oldsize);
-    return oldptr;
-  } else {
-
-    newptr = mm_malloc(size);
+    asize = ALIGNMENT * ((size + (WSIZE) + (ALIGNMENT-1)) / ALIGNMENT);
 
-    /* If realloc() fails the original block is left untouched  */
-    if(!newptr) {
-        return 0;
-    }
-
-    /* Copy the old data. */
-    // oldsize = GET_SIZE(HDRP(oldptr));
-    if(size < oldsize) oldsize = size;
-    memcpy(newptr, oldptr, oldsize);
+  // only blocks of more than MMAP_THRESHOLD bytes may be mapped
+  if (asize > MMAP_THRESHOLD) {
+    free(ptr);
+    return;
+  }
+#ifdef DEBUG
+  // a size the block cannot hold would file it under the wrong cache bin
+  if (IS_MAPPED(ptr) || !GET_ALLOC(HDRP(ptr)) || asize > OWN_SIZE(ptr)) {
+    fprintf(stderr, "Error: free_sized of %zu bytes does not fit block "
+            "(%p)\n", size, ptr);
+    exit(-1);
+  }
+#endif
 
-    /* Free the old block. */
-    mm_free(oldptr);
-    return newptr;
+#ifdef MM_THREADSAFE
+  // the block may be bigger than asize if place did not split it, which
+  // only wastes the difference while it sits in the cache
+  if (asize <= TCACHE_MAX) {
+    tcache_put(ptr, asize);
+  } else {
+    remote_free(ptr, ptr);
   }
+#else
+  free_blk(ptr);
+#endif
 }
 
 /*
- * calloc - malloc + initialize to 0
+ * malloc_usable_size - number of bytes that can be used at ptr, at least
+ *                      the size it was allocated with: the whole block
+ *                      but its header, including what place did not split
+ *                      off. Returns 0 for NULL
  */
-void *calloc (size_t nmemb, size_t size) {
-  size_t bytes = nmemb * size;
-  void *ptr = malloc(bytes);
-  memset(ptr, 0, bytes);
-
-  return ptr;
+size_t malloc_usable_size(void *ptr) {
+  if (ptr == 0)
+    return 0;
+#ifdef MM_SLAB
+  if (isSlab(ptr))
+    return SLAB_OF(ptr)->size;
+#endif
+  if (IS_MAPPED(ptr))
+    return MAP_LEN(ptr) - MMAP_HDRSIZE;
+  return OWN_SIZE(ptr) - WSIZE;
 }
 
-/* 
- * The remaining routines are internal helper routines 
- */
-
-/* 
- * extend_heap - Extend heap with free block and return its block pointer
- *               Also set palloc of new epilogue to 0
+/*
+ * malloc_batch - allocate n blocks of size bytes into out[0..n-1], in
+ *                address order, all carved out of one free block. Groups
+ *                of more than MMAP_THRESHOLD bytes take malloc one block
+ *                at a time instead. Returns the number of blocks allocated
  */
-static void *extend_heap(size_t words) 
-{
+size_t malloc_batch(size_t size, size_t n, void **out) {
+  size_t asize;
+  size_t csize;
+  size_t i;
+  unsigned int palloc;
   char *bp;
-  size_t size;
 
-  /* Allocate an even number of words to maintain alignment */
-  size = (words % 2) ? (words+1) * WSIZE : words * WSIZE; 
-  if ((long)(bp = mem_sbrk(size)) == -1)  
-    return NULL;                                        
+  if (size == 0 || n == 0 || size > MAX_REQUEST)
+    return 0;
 
-  /* Initialize free block header/footer and the epilogue header */
-  // bp will point to old end of heap
+  // do a similar thing as malloc
+  if (size <= 3*WSIZE)
+    asize = MINSIZE;
+  else
+    asize = ALIGNMENT * ((size + (WSIZE) + (ALIGNMENT-1)) / ALIGNMENT);
 
-  // fix pointer
-  unsigned int palloc = GETPALLOC(HDRP(bp));
-  PUT(HDRP(bp), PACKPA(size, 0, palloc));         /* Free block header */
-  PUT(FTRP(bp), PACK(size, 0));         /* Free block footer */
-  char *ep_ptr = (char *)NEXT_BLKP(bp);
-  PUT(HDRP(ep_ptr), PACK(0, 1));        /* New epilogue header */
+  if (size > MMAP_THRESHOLD || asize > MMAP_THRESHOLD / n) {
+    for (i = 0; i < n && (out[i] = malloc(size)) != NULL; i++)
+      ;
+    return i;
+  }
 
-  /* Coalesce if the previous block was free */
-  return coalesce(bp);
+  LOCK();
+  if ((bp = fit_blk(n * asize)) != NULL) {
+    place(bp, n * asize);
+    palloc = GETPALLOC(HDRP(bp));
+    csize = GET_SIZE(HDRP(bp));
+    // place set the palloc bit of the block after the group
+    for (i = 0; i < n - 1; i++) {
+      PUT(HDRP(bp), PACKPA(asize, 1, palloc));
+      out[i] = bp;
+      bp += asize;
+      palloc = 2;
+    }
+    PUT(HDRP(bp), PACKPA(csize - (n - 1) * asize, 1, palloc));
+    out[n - 1] = bp;
+  }
+  UNLOCK();
+  return bp == NULL ? 0 : n;
 }
 
 /*
- * getBin - get pointer to proper bin based on size
+ * cmpAddr - qsort order of block pointers by address
  */
-static inline char *getBin(size_t size) {
-  if (size < 64) {
-    // list for every size
-    return (heap_listp + (size - 2*DSIZE));
-  } else if (size >= 8192) {
-    // one list for blocks of size >= 8192
-    // 14 bins, so last one is at DSIZE*13
-    return (heap_listp + (DSIZE*13));
-  }
+static int cmpAddr(const void *a, const void *b) {
+  char *p = *(char * const *)a;
+  char *q = *(char * const *)b;
 
-  // powers of 2
-  int offset = 0;
-  while (size >>= 1) offset ++;
-  return (heap_listp + (DSIZE*offset));
+  return (p > q) - (p < q);
 }
 
 /*
- * join - joins two nodes
- *        Used for coalescing, to connect the prev and next of a node
- *        that no longer exists
+ * free_batch - free the n blocks in ptrs (which it sorts by address).
+ *              Every run of blocks that are neighbours in the heap becomes
+ *              one free block that is coalesced once, instead of a
+ *              coalesce per block. NULLs are skipped, mapped blocks unmapped
  */
-static inline void join(char *prev, char *next) {
-  // next points to prev
-  if (next != END) {
-    PUTPPTR(next, prev);
-  }
+void free_batch(void **ptrs, size_t n) {
+  size_t i, j;
+  size_t size;
+  char *bp;
+
+  qsort(ptrs, n, sizeof(*ptrs), cmpAddr);
+  LOCK();
+  for (i = 0; i < n; i = j) {
+    bp = ptrs[i];
+    j = i + 1;
+    if (bp == NULL)
+      continue;
+#ifdef MM_SLAB
+    if (isSlab(bp)) {
+      slab_free(bp);
+      continue;
+    }
+#endif
+    if (IS_MAPPED(bp)) {
+      unmapBlk(bp);
+      continue;
+    }
+    size = GET_SIZE(HDRP(bp));
+    // the block after a heap block is never a slot (a slab page starts
+    // with its metadata), nor is it mapped
+    while (j < n && (char *)ptrs[j] == bp + size)
+      size += GET_SIZE(HDRP(ptrs[j++]));
+    PUT(HDRP(bp), PACKPA(size, 0, GETPALLOC(HDRP(bp))));
+    PUT(FTRP(bp), PACK(size, 0));
+    coalesce(bp);
+#ifndef MM_SCAVENGER
+    // purge_clock still counts every block
+    for (; i < j; i++)
+      purge_tick();
+#endif
+  }
+#ifndef MM_SCAVENGER
+  if (heap_listp != 0)
+    auto_trim();
+#endif
+  UNLOCK();
+}
+
+/*
+ * mm_arena_create - make an empty arena. Returns NULL if malloc fails
+ */
+mm_arena_t *mm_arena_create(void) {
+  char *chunk = malloc(ARENA_CHUNK);
+  mm_arena_t *arena;
+
+  if (chunk == NULL)
+    return NULL;
+  *(char **)chunk = NULL;
+  arena = (mm_arena_t *)(chunk + CHUNK_LINK);
+  arena->chunks = chunk;
+  arena->cur = (char *)arena + ALIGN(sizeof(mm_arena_t));
+  arena->end = chunk + malloc_usable_size(chunk);
+  return arena;
+}
+
+/*
+ * mm_arena_alloc - bump-allocate size bytes from arena. Returns NULL for a
+ *                  size of 0, or if a new chunk is needed and malloc fails
+ */
+void *mm_arena_alloc(mm_arena_t *arena, size_t size) {
+  char *p = arena->cur;
+
+  if (size == 0)
+    return NULL;
+  if (size > ARENA_CHUNK / 4)
+    return arenaGrow(arena, size);
+  size = ALIGN(size);
+  if (size > (size_t)(arena->end - p))
+    return arenaGrow(arena, size);
+  arena->cur = p + size;
+  return p;
+}
+
+/*
+ * mm_arena_destroy - free arena and everything allocated from it, one
+ *                    free per chunk
+ */
+void mm_arena_destroy(mm_arena_t *arena) {
+  char *chunk = arena->chunks;
+  char *prev;
+
+  // the arena itself goes with the last (oldest) chunk
+  while (chunk != NULL) {
+    prev = *(char **)chunk;
+    free(chunk);
+    chunk = prev;
+  }
+}
+
+/*
+ * arenaGrow - allocate size bytes for arena from a new chunk: one of its
+ *             own for a big object, else a new ARENA_CHUNK that becomes
+ *             the one the arena bumps from
+ */
+static void *arenaGrow(mm_arena_t *arena, size_t size) {
+  char *chunk;
+
+  if (size > ARENA_CHUNK / 4) {
+    if (size > (size_t)-1 - CHUNK_LINK ||
+        (chunk = malloc(CHUNK_LINK + size)) == NULL)
+      return NULL;
+    // keep bumping from the newest chunk
+    *(char **)chunk = *(char **)arena->chunks;
+    *(char **)arena->chunks = chunk;
+    return chunk + CHUNK_LINK;
+  }
+
+  if ((chunk = malloc(ARENA_CHUNK)) == NULL)
+    return NULL;
+  *(char **)chunk = arena->chunks;
+  arena->chunks = chunk;
+  arena->cur = chunk + CHUNK_LINK + size;
+  arena->end = chunk + malloc_usable_size(chunk);
+  return chunk + CHUNK_LINK;
+}
+
+/*
+ * mm_pool_create - make a pool of objects of obj_size bytes. Returns NULL
+ *                  if obj_size is 0 or above POOL_MAX, or if the heap is
+ *                  out of memory
+ */
+mm_pool_t *mm_pool_create(size_t obj_size) {
+  char *slab;
+  mm_pool_t *pool;
+
+  if (obj_size == 0 || obj_size > POOL_MAX || (slab = poolSlab()) == NULL)
+    return NULL;
+  pool = (mm_pool_t *)(slab + CHUNK_LINK);
+  pool->size = (obj_size + (WSIZE-1)) & ~(size_t)(WSIZE-1);
+  pool->free = 0;
+  pool->slabs = slab;
+  pool->cur = (char *)pool + ALIGN(sizeof(mm_pool_t));
+  pool->end = slab + GET_SIZE(HDRP(slab)) - WSIZE;
+  return pool;
+}
+
+/*
+ * mm_pool_alloc - take a slot from pool: the first free one, else the
+ *                 next one never used, else one from a new slab. Returns
+ *                 NULL if the heap is out of memory
+ */
+void *mm_pool_alloc(mm_pool_t *pool) {
+  char *p;
+
+  if (pool->free != 0) {
+    p = END + pool->free;
+    pool->free = GET(p);
+    return p;
+  }
+  if (pool->size > (size_t)(pool->end - pool->cur)) {
+    if ((p = poolSlab()) == NULL)
+      return NULL;
+    *(char **)p = pool->slabs;
+    pool->slabs = p;
+    pool->cur = p + CHUNK_LINK;
+    pool->end = p + GET_SIZE(HDRP(p)) - WSIZE;
+  }
+  p = pool->cur;
+  pool->cur += pool->size;
+  return p;
+}
+
+/*
+ * mm_pool_free - give slot p back to pool
+ */
+void mm_pool_free(mm_pool_t *pool, void *p) {
+  if (p == NULL)
+    return;
+  PUT(p, pool->free);
+  pool->free = (unsigned int)((char *)p - END);
+}
+
+/*
+ * mm_pool_destroy - free pool and every slot in it, one free per slab
+ */
+void mm_pool_destroy(mm_pool_t *pool) {
+  char *slab = pool->slabs;
+  char *prev;
+
+  // the pool itself goes with the last (oldest) slab
+  while (slab != NULL) {
+    prev = *(char **)slab;
+    free(slab);
+    slab = prev;
+  }
+}
+
+/*
+ * poolSlab - allocate a slab of POOL_SLAB bytes, always in the heap (the
+ *            slot links are heap offsets), with a NULL link
+ */
+static char *poolSlab(void) {
+  char *slab;
+
+  LOCK();
+  slab = alloc_blk(POOL_SLAB);
+  UNLOCK();
+  if (slab != NULL)
+    *(char **)slab = NULL;
+  return slab;
+}
+
+/*
+ * free_blk - reset header and footer and coalesce. Caller holds heap_lock.
+ */
+static void free_blk(void *ptr) {
+  size_t size = GET_SIZE(HDRP(ptr));
+  if (heap_listp == 0){
+    init_heap();
+  }
+
+  unsigned int palloc = GETPALLOC(HDRP(ptr));
+  // update header and footer with previous allocation state
+  PUT(HDRP(ptr), PACKPA(size, 0, palloc));
+  PUT(FTRP(ptr), PACK(size, 0));
+  coalesce(ptr);
+
+#ifndef MM_SCAVENGER
+  // the scavenger thread does this, off the free path
+  auto_trim();
+  purge_tick();
+#endif
+}
+
+/*
+ * mm_trim - give the free memory at the top of the heap back to the OS,
+ *           keeping pad bytes of it. Returns 1 if the heap shrank.
+ */
+int mm_trim(size_t pad) {
+  int ret;
+
+  LOCK();
+#ifdef MM_THREADSAFE
+  remote_drain();
+#endif
+  ret = trim_heap(pad);
+  UNLOCK();
+  return ret;
+}
+
+/*
+ * mm_frag_stats - walk the heap and report its free bytes and the size of
+ *                 its largest free block (blocks held in thread caches or
+ *                 in slabs count as allocated)
+ */
+void mm_frag_stats(size_t *free_bytes, size_t *largest) {
+  char *bp;
+  size_t size;
+
+  *free_bytes = *largest = 0;
+  LOCK();
+  if (heap_listp != 0) {
+    for (bp = heap_listp; (size = GET_SIZE(HDRP(bp))) > 0; bp = NEXT_BLKP(bp)) {
+      if (GET_ALLOC(HDRP(bp)))
+        continue;
+      *free_bytes += size;
+      if (size > *largest)
+        *largest = size;
+    }
+  }
+  UNLOCK();
+}
+
+/*
+ * mm_fit_policy - set how many fitting blocks find_fit compares in a bin
+ *                 (0 for all of them) and the waste, in percent of the
+ *                 request, at which it stops early. Kept across mm_init.
+ */
+void mm_fit_policy(unsigned int budget, unsigned int slack) {
+  LOCK();
+  fit_budget = budget;
+  fit_slack = slack;
+  UNLOCK();
+}
+
+/*
+ * mm_fit_stats - report the find_fit calls since mm_init, the blocks they
+ *                looked at and the cycles they took. All zero unless
+ *                built with -DMM_FIT_STATS.
+ */
+void mm_fit_stats(unsigned long *calls, unsigned long *nodes,
+                  unsigned long *cycles) {
+  LOCK();
+#ifdef MM_FIT_STATS
+  *calls = fit_calls;
+  *nodes = fit_nodes;
+  *cycles = fit_cycles;
+#else
+  *calls = *nodes = *cycles = 0;
+#endif
+  UNLOCK();
+}
+
+
+/*
+ * realloc - reallocs in place if possible, otherwise allocates new block
+ */
+void *realloc(void *oldptr, size_t size) {
+  void *newptr;
+  size_t asize;
+  size_t oldsize;
+
+  /* If size == 0 then this is just free, and we return NULL. */
+  if(size == 0) {
+    mm_free(oldptr);
+    return 0;
+  }
+
+  /* If oldptr is NULL, then this is just malloc. */
+  if(oldptr == NULL) {
+    return mm_malloc(size);
+  }
+
+  /* No block can hold it, so leave the old one alone */
+  if (size > MAX_REQUEST)
+    return 0;
+
+#ifdef MM_SLAB
+  // a slot cannot grow, but it can keep a smaller payload
+  if (isSlab(oldptr)) {
+    oldsize = SLAB_OF(oldptr)->size;
+    if (size <= oldsize)
+      return oldptr;
+    if ((newptr = mm_malloc(size)) != NULL) {
+      memcpy(newptr, oldptr, oldsize);
+      mm_free(oldptr);
+    }
+    return newptr;
+  }
+#endif
+
+  oldsize = OWN_SIZE(oldptr);
+
+  // do a similar thing as malloc
+  if (size <= 3*WSIZE)                                      
+    asize = MINSIZE;                                     
+  else
+    asize = ALIGNMENT * ((size + (WSIZE) + (ALIGNMENT-1)) / ALIGNMENT);
+
+  if (IS_MAPPED(oldptr)) {
+    // stays huge: let the kernel resize the mapping
+    if (asize > MMAP_THRESHOLD) {
+      newptr = remapBlk(oldptr, asize);
+      if (newptr)
+        return newptr;
+    }
+    // size the mapped block like a heap block, header included
+    oldsize = MAP_LEN(oldptr) - MMAP_HDRSIZE + WSIZE;
+  } else if (asize <= oldsize) {
+    // this means we can simply split the current block or return old block
+    LOCK();
+    splitBlk(oldptr, asize, oldsize);
+    UNLOCK();
+    return oldptr;
+  } else {
+    LOCK();
+    newptr = growBlk(oldptr, asize, oldsize) ? oldptr :
+             mergePrevBlk(oldptr, asize, oldsize);
+    UNLOCK();
+    if (newptr)
+      return newptr;
+  }
+
+  newptr = mm_malloc(size);
+
+  /* If realloc() fails the original block is left untouched  */
+  if(!newptr) {
+      return 0;
+  }
+
+  /* Copy the old data. */
+  // the payload is the block minus its header
+  oldsize -= WSIZE;
+  if(size < oldsize) oldsize = size;
+  memcpy(newptr, oldptr, oldsize);
+
+  /* Free the old block. */
+  mm_free(oldptr);
+  return newptr;
+}
+
+/*
+ * calloc - malloc + initialize to 0, skipping what is known to be zero
+ *          already: a fresh mapping, and the part of a heap block at or
+ *          above zero_lo. Returns NULL if nmemb * size overflows.
+ */
+void *calloc (size_t nmemb, size_t size) {
+  size_t bytes;
+  size_t asize;
+  char *bp;
+  char *lo;
+  char *clean;
+  char *ftr;
+
+  if (size != 0 && nmemb > (size_t)-1 / size)
+    return NULL;
+  bytes = nmemb * size;
+  if (bytes == 0 || bytes > MAX_REQUEST)
+    return NULL;
+
+  // do a similar thing as malloc
+  if (bytes <= 3*WSIZE)
+    asize = MINSIZE;
+  else
+    asize = ALIGNMENT * ((bytes + (WSIZE) + (ALIGNMENT-1)) / ALIGNMENT);
+
+#ifdef MM_SLAB
+  // a slot may have been used before
+  if (bytes <= SLAB_MAX) {
+    if ((bp = malloc(bytes)) != NULL)
+      memset(bp, 0, bytes);
+    return bp;
+  }
+#endif
+
+#ifdef MM_THREADSAFE
+  if (asize <= TCACHE_MAX) {
+    if ((bp = tcache_get(asize)) != NULL)
+      memset(bp, 0, bytes);
+    return bp;
+  }
+#endif
+
+  // only the header words in front of bp are set in a new mapping
+  if (asize > MMAP_THRESHOLD && (bp = mapBlk(asize)) != NULL)
+    return bp;
+  LOCK();
+  lo = NULL;
+  if ((bp = fit_blk(asize)) != NULL) {
+    lo = zero_lo;
+    place(bp, asize);
+  }
+  UNLOCK();
+  if (bp == NULL)
+    return NULL;
+
+  // the links of the free block bp was, and its footer if that is now
+  // inside the payload, are the only non-zero words from lo up
+  clean = MAX(bp + 4*WSIZE, lo);
+  if (clean >= bp + bytes) {
+    memset(bp, 0, bytes);
+  } else {
+    memset(bp, 0, clean - bp);
+    ftr = bp + GET_SIZE(HDRP(bp)) - DSIZE;
+    if (ftr >= clean && ftr < bp + bytes)
+      PUT(ftr, 0);
+  }
+  return bp;
+}
+
+/*
+ * memalign - allocate a block of size bytes whose address is a multiple of
+ *            alignment, a power of 2. Returns NULL on a bad alignment
+ */
+void *memalign(size_t alignment, size_t size) {
+  size_t asize;
+  char *bp;
+
+  if (alignment == 0 || (alignment & (alignment - 1)) != 0)
+    return NULL;
+  if (alignment <= ALIGNMENT)
+    return malloc(size);
+  if (size == 0 || size > (size_t)-1 / 2 - alignment)
+    return NULL;
+
+  // do a similar thing as malloc
+  if (size <= 3*WSIZE)
+    asize = MINSIZE;
+  else
+    asize = ALIGNMENT * ((size + (WSIZE) + (ALIGNMENT-1)) / ALIGNMENT);
+
+  // a mapping starts on a page, so its payload is MMAP_HDRSIZE aligned
+  if (asize > MMAP_THRESHOLD && alignment <= MMAP_HDRSIZE &&
+      (bp = mapBlk(asize)) != NULL)
+    return bp;
+  LOCK();
+  bp = alignBlk(asize, alignment);
+  UNLOCK();
+  return bp;
+}
+
+/*
+ * posix_memalign - memalign that stores the block in *memptr. Returns
+ *                  EINVAL unless alignment is a power of 2 and a multiple
+ *                  of sizeof(void *), and ENOMEM if no block is found
+ */
+int posix_memalign(void **memptr, size_t alignment, size_t size) {
+  void *ptr;
+
+  if (alignment == 0 || alignment % sizeof(void *) != 0 ||
+      (alignment & (alignment - 1)) != 0)
+    return EINVAL;
+  if (size == 0) {
+    *memptr = NULL;
+    return 0;
+  }
+  if ((ptr = memalign(alignment, size)) == NULL)
+    return ENOMEM;
+  *memptr = ptr;
+  return 0;
+}
+
+/*
+ * aligned_alloc - C11 name for memalign
+ */
+void *aligned_alloc(size_t alignment, size_t size) {
+  return memalign(alignment, size);
+}
+
+/* 
+ * The remaining routines are internal helper routines 
+ */
+
+/* 
+ * extend_heap - Extend heap with free block and return its block pointer
+ *               Also set palloc of new epilogue to 0
+ */
+static void *extend_heap(size_t words) 
+{
+  char *bp;
+  size_t size;
+
+  /* Allocate a multiple of ALIGNMENT bytes to maintain alignment */
+  size = ALIGN(words * WSIZE);
+  if ((long)(bp = grow_heap(size)) == -1)  
+    return NULL;                                        
+
+  /* Initialize free block header/footer and the epilogue header */
+  // bp will point to old end of heap
+
+  // fix pointer
+  unsigned int palloc = GETPALLOC(HDRP(bp));
+  PUT(HDRP(bp), PACKPA(size, 0, palloc));         /* Free block header */
+  PUT(FTRP(bp), PACK(size, 0));         /* Free block footer */
+  char *ep_ptr = (char *)NEXT_BLKP(bp);
+  PUT(HDRP(ep_ptr), PACK(0, 1));        /* New epilogue header */
+
+  /* Coalesce if the previous block was free */
+  return coalesce(bp);
+}
+
+/*
+ * grow_heap - mem_sbrk size more bytes. Growing back over memory that free
+ *             just trimmed means the trim was premature, so trim less
+ *             eagerly from then on.
+ */
+static void *grow_heap(size_t size) {
+  // the new bytes are zero only from where memlib said so before growing
+  char *clean = mem_heap_clean();
+  void *p;
+
+  // mem_sbrk would truncate it, and no header could describe the block
+  if (size > MAX_BLKSIZE)
+    return (void *)-1;
+  if ((p = mem_sbrk(size)) == (void *)-1)
+    return p;
+  dirtyTo(MIN(clean, (char *)mem_heap_hi() + 1));
+  if (auto_trimmed) {
+    auto_trimmed = 0;
+    trim_threshold *= 2;
+  }
+  return p;
+}
+
+/*
+ * auto_trim - trim the heap if the free block before the epilogue is
+ *             bigger than trim_threshold
+ */
+static void auto_trim(void) {
+  char *epilogue = (char *)mem_heap_hi() + 1;
+
+  if (!GETPALLOC(HDRP(epilogue)) &&
+      GET_SIZE(HDRP(PREV_BLKP(epilogue))) > trim_threshold &&
+      trim_heap(TRIM_PAD))
+    auto_trimmed = 1;
+}
+
+/*
+ * trim_heap - cut the free block before the epilogue down to pad bytes
+ *             (remove it if pad is below MINSIZE) and shrink the heap by
+ *             the rest. Returns 1 if the heap shrank, 0 if the last block
+ *             is allocated or no bigger than pad. Caller holds heap_lock.
+ */
+static int trim_heap(size_t pad) {
+  char *epilogue;
+  char *bp;
+  size_t size;
+  size_t keep = (pad < MINSIZE) ? 0 : ALIGN(pad);
+
+  if (heap_listp == 0)
+    return 0;
+  epilogue = (char *)mem_heap_hi() + 1;
+  if (GETPALLOC(HDRP(epilogue)))
+    return 0;
+  bp = PREV_BLKP(epilogue);
+  size = GET_SIZE(HDRP(bp));
+  if (size <= keep)
+    return 0;
+
+  removeBlk(bp, getBin(size));
+  mem_sbrk(-(int)(size - keep));
+  if (keep) {
+    PUT(HDRP(bp), PACKPA(keep, 0, GETPALLOC(HDRP(bp))));
+    PUT(FTRP(bp), PACK(keep, 0));
+    PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1));   /* New epilogue header */
+    // still the last block, so the wilderness again
+    insertBlk(bp, getBin(keep));
+  } else {
+    // bp's header becomes the epilogue, after an allocated block
+    PUT(HDRP(bp), PACKPA(0, 1, 2));
+  }
+  // grow_heap finds out whether the cut-off bytes come back zeroed
+  if (zero_lo > (char *)mem_heap_hi() + 1)
+    zero_lo = (char *)mem_heap_hi() + 1;
+  return 1;
+}
+
+#ifdef MM_TLSF
+/*
+ * getBin - get pointer to proper list based on size: first level is the
+ *          power of 2, second level the SL_BITS bits below it
+ */
+static inline char *getBin(size_t size) {
+  unsigned int fl, sl;
+
+  if (size < (1 << FL_SHIFT)) {
+    fl = 0;
+    sl = size >> 3;
+  } else {
+    int log = 63 - __builtin_clzl(size);
+    fl = log - FL_SHIFT + 1;
+    sl = (size >> (log - SL_BITS)) & (SL_COUNT - 1);
+  }
+  return (heap_listp + DSIZE*(fl*SL_COUNT + sl));
+}
+
+/*
+ * markBin/unmarkBin/binMarked - set, clear and test the bits of a list
+ */
+static inline void markBin(char *bin) {
+  unsigned int i = BIN_INDEX(bin);
+  fl_map |= 1U << (i / SL_COUNT);
+  sl_map[i / SL_COUNT] |= 1U << (i % SL_COUNT);
+}
+
+static inline void unmarkBin(char *bin) {
+  unsigned int i = BIN_INDEX(bin);
+  sl_map[i / SL_COUNT] &= ~(1U << (i % SL_COUNT));
+  if (sl_map[i / SL_COUNT] == 0)
+    fl_map &= ~(1U << (i / SL_COUNT));
+}
+
+static inline int binMarked(char *bin) {
+  unsigned int i = BIN_INDEX(bin);
+  return (sl_map[i / SL_COUNT] >> (i % SL_COUNT)) & 1;
+}
+#else
+/*
+ * markBin/unmarkBin/binMarked - set, clear and test the bit of a bin
+ */
+static inline void markBin(char *bin) {
+  bin_map |= 1UL << BIN_INDEX(bin);
+}
+
+static inline void unmarkBin(char *bin) {
+  bin_map &= ~(1UL << BIN_INDEX(bin));
+}
+
+static inline int binMarked(char *bin) {
+  return (bin_map >> BIN_INDEX(bin)) & 1;
+}
+
+/*
+ * getBin - get pointer to proper bin based on size
+ */
+static inline char *getBin(size_t size) {
+  if (size < 64) {
+    // list for every size
+    return (heap_listp + (size - 2*DSIZE));
+  } else if (size >= 8192) {
+    // one tree for blocks of size >= 8192
+    return TREE_BIN;
+  }
+
+  // the highest set bit picks the power of 2 (64 is 2^6), the
+  // SUBBIN_BITS bits below it pick the sub-bin within it
+  int log = 63 - __builtin_clzl(size);
+  int sub = (size >> (log - SUBBIN_BITS)) & ((1 << SUBBIN_BITS) - 1);
+  return (heap_listp + DSIZE*(6 + ((log - 6) << SUBBIN_BITS) + sub));
+}
+#endif /* def MM_TLSF */
+
+/*
+ * purge_tick - advance purge_clock by one free, and run purge_scan every
+ *              PURGE_INTERVAL ticks
+ */
+static void purge_tick(void) {
+  if (++purge_clock == PURGED)
+    purge_clock++;
+#ifndef MM_SCAVENGER
+  if (purge_clock % PURGE_INTERVAL == 0)
+    purge_scan(purgeBlk);
+#endif
+}
+
+/*
+ * purgePages - release the whole pages of free block bp between its stamp
+ *              and its footer, so its header, links and footer stay
+ *              resident and intact
+ */
+static void purgePages(char *bp) {
+  size_t pagesize = mem_pagesize();
+  char *lo, *hi;
+
+  lo = (char *)(((size_t)bp + 4*WSIZE + pagesize - 1) & ~(pagesize - 1));
+  // the scavenger calls this unlocked, with bp marked allocated, so a
+  // neighbour's free may flip its palloc bit meanwhile
+  hi = (char *)((size_t)(bp + OWN_SIZE(bp) - DSIZE) & ~(pagesize - 1));
+  if (lo < hi)
+    mem_purge(lo, hi - lo);
+}
+
+/*
+ * purgeBlk - purge free block bp if it has decayed
+ */
+static void purgeBlk(char *bp) {
+  if (!DECAYED(bp))
+    return;
+  purgePages(bp);
+  STAMP(bp) = PURGED;
+}
+
+#ifndef MM_TLSF
+/*
+ * purgeTree - call fn on every node of the subtree of the tree bin at bp
+ */
+static void purgeTree(char *bp, void (*fn)(char *)) {
+  if (bp == END)
+    return;
+  fn(bp);
+  purgeTree(GETLEFT(bp), fn);
+  purgeTree(GETRIGHT(bp), fn);
+}
+#endif
+
+/*
+ * purge_scan - call fn (purgeBlk, or queueBlk for the scavenger) on every
+ *              free block of at least PURGE_MIN bytes, the wilderness
+ *              included. fn must not move blocks between bins.
+ *              Caller holds heap_lock.
+ */
+static void purge_scan(void (*fn)(char *)) {
+  char *bp;
+
+  if (heap_listp == 0)
+    return;
+  for (char *bin = getBin(PURGE_MIN); bin != bin_end; bin += DSIZE) {
+    if (!binMarked(bin))
+      continue;
+#ifndef MM_TLSF
+    if (bin == TREE_BIN) {
+      purgeTree(GETNPTR(bin), fn);
+      continue;
+    }
+#endif
+    for (bp = GETNPTR(bin); bp != END; bp = GETNPTR(bp)) {
+      if (GET_SIZE(HDRP(bp)) >= PURGE_MIN)
+        fn(bp);
+    }
+  }
+  // the wilderness is in no bin, but decays like any other free block
+  if (wild != NULL && GET_SIZE(HDRP(wild)) >= PURGE_MIN)
+    fn(wild);
+}
+
+#ifdef MM_SCAVENGER
+/*
+ * The following routines implement the scavenger thread
+ */
+
+/*
+ * queueBlk - if free block bp has decayed, push it onto purge_queue,
+ *            linked through its stamp
+ */
+static void queueBlk(char *bp) {
+  if (!DECAYED(bp))
+    return;
+  PUTNPTR(&STAMP(bp), purge_queue);
+  purge_queue = bp;
+}
+
+/*
+ * scavenge - one pass of the scavenger. Under heap_lock, trim the top of
+ *            the heap, then take every decayed block out of its bin and
+ *            mark it allocated, so malloc cannot hand it out. Purge the
+ *            blocks without the lock, then free them again: a block that
+ *            nothing coalesced with meanwhile keeps the PURGED stamp.
+ *            scavenge_lock keeps mm_init, and mem_hold the driver's heap
+ *            resets, out until the pass is over.
+ */
+static void scavenge(void) {
+  char *bp;
+  char *next;
+  char *list;
+  size_t size;
+
+  mem_hold();
+  pthread_mutex_lock(&scavenge_lock);
+  LOCK();
+  // the driver empties the heap with mem_reset_brk before mm_init
+  if (heap_listp == 0 || mem_heapsize() == 0) {
+    UNLOCK();
+    pthread_mutex_unlock(&scavenge_lock);
+    mem_release();
+    return;
+  }
+  remote_drain();
+  purge_tick();
+  auto_trim();
+
+  purge_queue = END;
+  purge_scan(queueBlk);
+  list = purge_queue;
+  for (bp = list; bp != END; bp = GETNPTR(&STAMP(bp))) {
+    size = GET_SIZE(HDRP(bp));
+    removeBlk(bp, getBin(size));
+    PUT(HDRP(bp), PACKPA(size, 1, GETPALLOC(HDRP(bp))));
+    PUTPALLOC(HDRP(NEXT_BLKP(bp)), 2);
+  }
+  UNLOCK();
+
+  for (bp = list; bp != END; bp = GETNPTR(&STAMP(bp)))
+    purgePages(bp);
+
+  LOCK();
+  for (bp = list; bp != END; bp = next) {
+    next = GETNPTR(&STAMP(bp));
+    size = GET_SIZE(HDRP(bp));
+    PUT(HDRP(bp), PACKPA(size, 0, GETPALLOC(HDRP(bp))));
+    PUT(FTRP(bp), PACK(size, 0));
+    if (coalesce(bp) == bp && GET_SIZE(HDRP(bp)) == size)
+      STAMP(bp) = PURGED;
+  }
+  UNLOCK();
+  pthread_mutex_unlock(&scavenge_lock);
+  mem_release();
+}
+
+/*
+ * scavenger - body of the scavenger thread, a pass every SCAVENGE_MS
+ */
+static void *scavenger(void *arg) {
+  struct timespec ts = { SCAVENGE_MS / 1000, (SCAVENGE_MS % 1000) * 1000000L };
+
+  for (;;) {
+    nanosleep(&ts, NULL);
+    scavenge();
+  }
+  return NULL;
+}
+
+/*
+ * scavenger_start - start the scavenger thread, once per process
+ */
+static void scavenger_start(void) {
+  pthread_t tid;
+
+  if (pthread_create(&tid, NULL, scavenger, NULL) == 0)
+    pthread_detach(tid);
+}
+#endif /* def MM_SCAVENGER */
+
+/*
+ * join - joins two nodes
+ *        Used for coalescing, to connect the prev and next of a node
+ *        that no longer exists
+ */
+static inline void join(char *prev, char *next) {
+  // next points to prev
+  if (next != END) {
+    PUTPPTR(next, prev);
+  }
 
   // and prev points to next
   if (prev != END) {
     PUTNPTR(prev, next);
   }
+
+  // prev is a bin head and nothing follows, so the bin is now empty
+  if (next == END && IS_BIN(prev)) {
+    unmarkBin(prev);
+  }
 }
 
 /*
@@ -394,6 +2085,418 @@ static inline void insertAtRoot(char *bp, char *bin, char *first_blk) {
   if (first_blk != END) {
     PUTPPTR(first_blk, bp);
   }
+  markBin(bin);
+}
+
+#ifdef MM_OOB_BINS
+/*
+ * The following routines implement the out-of-band list bins
+ */
+
+/*
+ * vecGrow - double the capacity of bin vector v, in place if it is the
+ *           last one in oob_area, or at the end of oob_area. If there is
+ *           no room, copy every vector into a new mapping twice the size
+ *           of their capacities. Returns 0 if out of memory.
+ *           Caller holds heap_lock.
+ */
+static int vecGrow(fvec_t *v) {
+  unsigned int cap = v->cap ? 2 * v->cap : OOB_MINCAP;
+  size_t pagesize = mem_pagesize();
+  size_t need = 0;
+  size_t len;
+  fdesc_t *area;
+  unsigned int top = 0;
+
+  if (v->base + v->cap == oob_top &&
+      (v->base + cap) * sizeof(fdesc_t) <= oob_len) {
+    oob_top = v->base + cap;
+    v->cap = cap;
+    return 1;
+  }
+  if ((oob_top + cap) * sizeof(fdesc_t) <= oob_len) {
+    memcpy(oob_area + oob_top, oob_area + v->base, v->len * sizeof(fdesc_t));
+    v->base = oob_top;
+    v->cap = cap;
+    oob_top += cap;
+    return 1;
+  }
+
+  // out of room, which also drops the holes moved vectors left behind
+  for (fvec_t *w = bin_vec; w < bin_vec + NBINS; w++)
+    need += (w == v) ? cap : w->cap;
+  len = (2 * need * sizeof(fdesc_t) + pagesize - 1) & ~(pagesize - 1);
+  if ((area = mem_mmap(len)) == (void *)-1)
+    return 0;
+  for (fvec_t *w = bin_vec; w < bin_vec + NBINS; w++) {
+    if (w->len)
+      memcpy(area + top, oob_area + w->base, w->len * sizeof(fdesc_t));
+    w->base = top;
+    if (w == v)
+      w->cap = cap;
+    top += w->cap;
+  }
+  if (oob_area != NULL)
+    mem_munmap(oob_area, oob_len);
+  oob_area = area;
+  oob_len = len;
+  oob_top = top;
+  return 1;
+}
+
+/*
+ * descPush - append a descriptor of free block bp to list bin bin. If the
+ *            vector cannot grow, bp goes on oob_spill (UNBINNED) instead
+ */
+static inline void descPush(char *bp, char *bin) {
+  fvec_t *v = &bin_vec[BIN_INDEX(bin)];
+  fdesc_t *d;
+
+  if (v->len == v->cap && !vecGrow(v)) {
+    DESC_IDX(bp) = UNBINNED;
+    PUTNPTR(bp + WSIZE, oob_spill);
+    oob_spill = bp;
+    return;
+  }
+  d = oob_area + v->base + v->len;
+  d->off = (unsigned int)(bp - END);
+  d->size = GET_SIZE(HDRP(bp));
+  DESC_IDX(bp) = v->len++;
+  markBin(bin);
+}
+
+/*
+ * descRemove - drop the descriptor of free block bp from list bin bin and
+ *              move the bin's last descriptor into its slot
+ */
+static inline void descRemove(char *bp, char *bin) {
+  fvec_t *v = &bin_vec[BIN_INDEX(bin)];
+  fdesc_t *d = oob_area + v->base;
+  unsigned int i = DESC_IDX(bp);
+  char *prev = NULL;
+
+  if (i == UNBINNED) {
+    // oob_spill only holds what no vector had room for, so it is short
+    for (char *p = oob_spill; p != bp; p = SPILL_NEXT(p))
+      prev = p;
+    if (prev == NULL)
+      oob_spill = SPILL_NEXT(bp);
+    else
+      PUTNPTR(prev + WSIZE, SPILL_NEXT(bp));
+    return;
+  }
+  if (i != --v->len) {
+    d[i] = d[v->len];
+    DESC_IDX(END + d[i].off) = i;
+  }
+  if (v->len == 0)
+    unmarkBin(bin);
+}
+
+/*
+ * descResize - free block bp grew but stays in list bin bin, update the
+ *              size in its descriptor
+ */
+static inline void descResize(char *bp, char *bin, size_t size) {
+  if (DESC_IDX(bp) != UNBINNED)
+    oob_area[bin_vec[BIN_INDEX(bin)].base + DESC_IDX(bp)].size = size;
+}
+#endif /* def MM_OOB_BINS */
+
+/*
+ * insertBlk - insert free block bp into bin, which must be getBin(size(bp)),
+ *             or make it the wilderness if it is the last block. The
+ *             header of bp must be up to date, and the epilogue in place.
+ */
+static inline void insertBlk(char *bp, char *bin) {
+  // restart the purge decay, the block is new or has changed
+  if (GET_SIZE(HDRP(bp)) >= PURGE_MIN)
+    STAMP(bp) = purge_clock;
+  // the last block is the wilderness, find_fit does not see it
+  if (isLast(bp)) {
+    wild = bp;
+    return;
+  }
+#ifndef MM_TLSF
+  if (bin == TREE_BIN) {
+    treeInsert(bp);
+    return;
+  }
+#endif
+#if defined(MM_OOB_BINS)
+  descPush(bp, bin);
+#elif defined(MM_ADDR_ORDER)
+  addrInsert(bp, bin);
+#else
+  insertAtRoot(bp, bin, GETNPTR(bin));
+#endif
+}
+
+/*
+ * removeBlk - unlink free block bp from bin, the bin it currently sits in
+ *             (or give up the wilderness). Only the links of bp are read,
+ *             so its header may already have been overwritten
+ */
+static inline void removeBlk(char *bp, char *bin) {
+  if (bp == wild) {
+    wild = NULL;
+    return;
+  }
+#ifndef MM_TLSF
+  if (bin == TREE_BIN) {
+    treeRemove(bp);
+    return;
+  }
+#endif
+#if defined(MM_OOB_BINS)
+  descRemove(bp, bin);
+#elif defined(MM_ADDR_ORDER)
+  addrRemove(bp, bin);
+#else
+  join(GETPPTR(bp), GETNPTR(bp));
+#endif
+}
+
+/*
+ * isLast - whether bp, whose header is up to date, is the last block
+ *          before the epilogue
+ */
+static inline int isLast(char *bp) {
+  return NEXT_BLKP(bp) == (char *)mem_heap_hi() + 1;
+}
+
+#ifndef MM_TLSF
+/*
+ * The following routines implement the tree bin (not with -DMM_TLSF)
+ */
+
+/*
+ * treeLess - ordering of tree nodes, by size and then by address
+ */
+static inline int treeLess(char *a, char *b) {
+  size_t asize = GET_SIZE(HDRP(a));
+  size_t bsize = GET_SIZE(HDRP(b));
+  return asize < bsize || (asize == bsize && a < b);
+}
+
+/*
+ * treeRelink - make the parent of old point to new instead
+ *              The parent of the root is TREE_BIN, which keeps the root
+ *              in its next slot
+ */
+static inline void treeRelink(char *parent, char *old, char *new) {
+  if (parent == TREE_BIN) {
+    PUTNPTR(parent, new);
+  } else if (GETLEFT(parent) == old) {
+    PUTLEFT(parent, new);
+  } else {
+    PUTRIGHT(parent, new);
+  }
+}
+
+/*
+ * treeRotateUp - rotate node x above its parent, preserving the order
+ */
+static void treeRotateUp(char *x) {
+  char *p = GETPARENT(x);
+  char *g = GETPARENT(p);
+  char *child;
+
+  if (GETLEFT(p) == x) {
+    child = GETRIGHT(x);
+    PUTLEFT(p, child);
+    PUTRIGHT(x, p);
+  } else {
+    child = GETLEFT(x);
+    PUTRIGHT(p, child);
+    PUTLEFT(x, p);
+  }
+  if (child != END) {
+    PUTPARENT(child, p);
+  }
+  PUTPARENT(p, x);
+  PUTPARENT(x, g);
+  treeRelink(g, p, x);
+}
+
+/*
+ * treeInsert - insert free block bp into the tree bin
+ *              Walk down to a leaf by (size, address), then rotate bp up
+ *              until its parent has a higher priority
+ */
+static void treeInsert(char *bp) {
+  char *parent = TREE_BIN;
+  char *cur = GETNPTR(TREE_BIN);
+
+  while (cur != END) {
+    parent = cur;
+    cur = treeLess(bp, cur) ? GETLEFT(cur) : GETRIGHT(cur);
+  }
+
+  PUTLEFT(bp, END);
+  PUTRIGHT(bp, END);
+  PUTPARENT(bp, parent);
+  if (parent == TREE_BIN) {
+    PUTNPTR(parent, bp);
+  } else if (treeLess(bp, parent)) {
+    PUTLEFT(parent, bp);
+  } else {
+    PUTRIGHT(parent, bp);
+  }
+
+  while (GETPARENT(bp) != TREE_BIN &&
+         PRIORITY(bp) > PRIORITY(GETPARENT(bp))) {
+    treeRotateUp(bp);
+  }
+  markBin(TREE_BIN);
+}
+
+/*
+ * treeRemove - unlink bp from the tree bin
+ *              Rotate bp down below its higher-priority child until it has
+ *              at most one child, then splice it out. Only links are used,
+ *              so this works even if the header of bp has been rewritten.
+ */
+static void treeRemove(char *bp) {
+  char *left;
+  char *right;
+  char *child;
+
+  while ((left = GETLEFT(bp)) != END && (right = GETRIGHT(bp)) != END) {
+    treeRotateUp(PRIORITY(left) > PRIORITY(right) ? left : right);
+  }
+
+  child = (GETLEFT(bp) != END) ? GETLEFT(bp) : GETRIGHT(bp);
+  if (child != END) {
+    PUTPARENT(child, GETPARENT(bp));
+  }
+  treeRelink(GETPARENT(bp), bp, child);
+
+  if (GETNPTR(TREE_BIN) == END) {
+    unmarkBin(TREE_BIN);
+  }
+}
+
+/*
+ * treeFit - best fit in the tree bin: the smallest block of at least asize
+ *           bytes, lowest address first among equal sizes
+ */
+static void *treeFit(size_t asize) {
+  char *best = NULL;
+  char *cur = GETNPTR(TREE_BIN);
+
+  while (cur != END) {
+    // one of the children is visited next, start loading both
+    PREFETCH(HDRP(GETLEFT(cur)));
+    PREFETCH(HDRP(GETRIGHT(cur)));
+    FIT_NODE();
+    if (GET_SIZE(HDRP(cur)) >= asize) {
+      best = cur;
+      cur = GETLEFT(cur);
+    } else {
+      cur = GETRIGHT(cur);
+    }
+  }
+  return best;
+}
+#endif /* ndef MM_TLSF */
+
+#ifdef MM_ADDR_ORDER
+/*
+ * The following routines implement the address-ordered list bins. A slot
+ * is the 4-byte field that holds a subtree: the bin head, or the left
+ * (bp) or right (bp + WSIZE) slot of a node.
+ */
+
+/*
+ * addrInsert - insert free block bp into the treap of list bin bin: go
+ *              down while the nodes outrank bp, put bp there and split
+ *              the subtree it displaces into bp's left and right
+ */
+static void addrInsert(char *bp, char *bin) {
+  unsigned int prio = PRIORITY(bp);
+  char *slot = bin;
+  char *cur = GETNPTR(slot);
+  char *lslot = bp;
+  char *rslot = bp + WSIZE;
+
+  while (cur != END && PRIORITY(cur) > prio) {
+    slot = (bp < cur) ? cur : cur + WSIZE;
+    cur = GETNPTR(slot);
+  }
+  PUTNPTR(slot, bp);
+  while (cur != END) {
+    if (cur < bp) {
+      // cur and its left subtree go left of bp, its right is split on
+      PUTNPTR(lslot, cur);
+      lslot = cur + WSIZE;
+    } else {
+      PUTNPTR(rslot, cur);
+      rslot = cur;
+    }
+    cur = GETNPTR(cur < bp ? lslot : rslot);
+  }
+  PUTNPTR(lslot, END);
+  PUTNPTR(rslot, END);
+  markBin(bin);
+}
+
+/*
+ * addrRemove - unlink free block bp from the treap of list bin bin: find
+ *              the slot that holds it by address, and merge its subtrees
+ *              into that slot. Only addresses and links are read.
+ */
+static void addrRemove(char *bp, char *bin) {
+  char *slot = bin;
+  char *cur;
+  char *left = GETLEFT(bp);
+  char *right = GETRIGHT(bp);
+
+  while ((cur = GETNPTR(slot)) != bp)
+    slot = (bp < cur) ? cur : cur + WSIZE;
+  while (left != END && right != END) {
+    if (PRIORITY(left) > PRIORITY(right)) {
+      PUTNPTR(slot, left);
+      slot = left + WSIZE;
+      left = GETRIGHT(left);
+    } else {
+      PUTNPTR(slot, right);
+      slot = right;
+      right = GETLEFT(right);
+    }
+  }
+  PUTNPTR(slot, (left != END) ? left : right);
+  if (GETNPTR(bin) == END)
+    unmarkBin(bin);
+}
+
+/*
+ * addrFit - lowest-addressed block of at least asize bytes in the subtree
+ *           at bp, or NULL. In a bin above asize's own every block fits,
+ *           and this is a walk down the left spine.
+ */
+static char *addrFit(char *bp, size_t asize) {
+  char *hit;
+
+  while (bp != END) {
+    if ((hit = addrFit(GETLEFT(bp), asize)) != NULL)
+      return hit;
+    FIT_NODE();
+    if (GET_SIZE(HDRP(bp)) >= asize)
+      return bp;
+    bp = GETRIGHT(bp);
+  }
+  return NULL;
+}
+#endif /* def MM_ADDR_ORDER */
+
+/*
+ * dirtyTo - the heap bytes below p may no longer be zero: an allocated
+ *           block ends at p, or the links of a merged block lie below it
+ */
+static inline void dirtyTo(char *p) {
+  if (p > zero_lo)
+    zero_lo = p;
 }
 
 /*
@@ -401,27 +2504,17 @@ static inline void insertAtRoot(char *bp, char *bin, char *first_blk) {
  */
 static inline void coalesceNext(void *bp, size_t size) {
   char *next;
-  char *first_blk;
   char *bin;
-  char *next_next = END;
-  char *next_prev = END;
   next = NEXT_BLKP(bp);
+  // take next out of its bin while its header is still intact
+  removeBlk(next, getBin(GET_SIZE(HDRP(next))));
+  dirtyTo(next + 4*WSIZE);
   size += GET_SIZE(HDRP(next));
   bin = getBin(size);
   PUT(HDRP(bp), PACKPA(size, 0, 2));
   PUT(FTRP(bp), PACK(size, 0));
 
-  // if next is not epilogue, get next and prev
-  if (next != NULL && (unsigned long)HDRP(next) != 1) {
-    next_next = GETNPTR(next);
-    next_prev = GETPPTR(next);
-  }
-
-  join(next_prev, next_next);
-
-  // get first block (we do it here to avoid nasty edge cases)
-  first_blk = GETNPTR(bin);
-  insertAtRoot(bp, bin, first_blk);
+  insertBlk(bp, bin);
 
   // update next block to show that current block is free
   PUTPALLOC(HDRP(NEXT_BLKP(bp)), 0);
@@ -435,19 +2528,22 @@ static inline void coalesceNext(void *bp, size_t size) {
  *            There is one edge case, when prev == first_blk and 
  *            getBin(size(prev + bp)) == getBin(size(prev)). In this case,
  *            we return immediately after coalescing and do not manipulate
- *            pointers.
+ *            pointers. This does not apply to the tree bin, where a block
+ *            that grows has to move, nor to a block that becomes the
+ *            wilderness. With -DMM_OOB_BINS the same holds for any block
+ *            of a list bin, whose descriptor just gets the new size, and
+ *            with -DMM_ADDR_ORDER, where the block keeps its address and
+ *            so its place.
  */
 static void *coalesce(void *bp) 
 {
   char *next;
+#if !defined(MM_OOB_BINS) && !defined(MM_ADDR_ORDER)
   char *first_blk;
+#endif
   char *bin;
   char *prev_bin;
   unsigned int palloc;
-  char *next_next = END;
-  char *next_prev = END;
-  char *prev_next = END;
-  char *prev_prev = END;
   size_t prev_alloc = GETPALLOC(HDRP(bp));
   size_t next_alloc = GET_ALLOC(HDRP(NEXT_BLKP(bp)));
   size_t size = GET_SIZE(HDRP(bp));
@@ -457,9 +2553,7 @@ static void *coalesce(void *bp)
   if (prev_alloc && next_alloc) {            /* Case 1 */
     // get bin to put block
     bin = getBin(size);
-    // get first block of bin
-    first_blk = GETNPTR(bin);
-    insertAtRoot(bp, bin, first_blk);
+    insertBlk(bp, bin);
     // update allocation state of next block
     PUTPALLOC(HDRP(NEXT_BLKP(bp)), 0);
     return bp;
@@ -470,6 +2564,7 @@ static void *coalesce(void *bp)
   }
 
   else if (!prev_alloc && next_alloc) {      /* Case 3 */
+    dirtyTo((char *)bp + 4*WSIZE);
     size += GET_SIZE(HDRP(PREV_BLKP(bp)));
     bin = getBin(size);
     // prev_bin is bin that previous block is currently in
@@ -479,84 +2574,384 @@ static void *coalesce(void *bp)
     PUT(HDRP(PREV_BLKP(bp)), PACKPA(size, 0, palloc));
     bp = PREV_BLKP(bp);
 
+#if defined(MM_OOB_BINS) || defined(MM_ADDR_ORDER)
+    if (prev_bin == bin && !IS_TREE_BIN(bin) && !isLast(bp)) {
+#ifdef MM_OOB_BINS
+      descResize(bp, bin, size);
+#endif
+#else
     first_blk = GETNPTR(bin);
     // if bp == first_blk and bp is the proper size, return bp
-    if (((unsigned long)first_blk == (unsigned long)bp) && prev_bin == bin) {
+    if (((unsigned long)first_blk == (unsigned long)bp) && prev_bin == bin &&
+        !IS_TREE_BIN(bin) && !isLast(bp)) {
+#endif
+      if (size >= PURGE_MIN)
+        STAMP(bp) = purge_clock;
       PUTPALLOC(HDRP(NEXT_BLKP(bp)), 0);
       return bp;
     }
 
-    // get next and prev for bp, which is the original prev block
-    prev_prev = GETPPTR(bp);
-    prev_next = GETNPTR(bp);
+    // bp is the original prev block, move it to its new bin
+    removeBlk(bp, prev_bin);
+    insertBlk(bp, bin);
+    // update allocation state of next block
+    PUTPALLOC(HDRP(NEXT_BLKP(bp)), 0);
+  }
+
+  else {                                     /* Case 4 */
+    next = NEXT_BLKP(bp);
+    // take next out of its bin while its header is still intact
+    removeBlk(next, getBin(GET_SIZE(HDRP(next))));
+    dirtyTo(next + 4*WSIZE);
+    size += GET_SIZE(HDRP(PREV_BLKP(bp))) + 
+        GET_SIZE(FTRP(next));
+    bin = getBin(size);
+    prev_bin = getBin(GET_SIZE(HDRP(PREV_BLKP(bp))));
+    palloc = GETPALLOC(HDRP(PREV_BLKP(bp)));
+    PUT(HDRP(PREV_BLKP(bp)), PACKPA(size, 0, palloc));
+    PUT(FTRP(NEXT_BLKP(bp)), PACK(size, 0));
+    bp = PREV_BLKP(bp);
+
+#if defined(MM_OOB_BINS) || defined(MM_ADDR_ORDER)
+    if (prev_bin == bin && !IS_TREE_BIN(bin) && !isLast(bp)) {
+#ifdef MM_OOB_BINS
+      descResize(bp, bin, size);
+#endif
+#else
+    // get first block (we do it here to avoid nasty edge cases)
+    first_blk = GETNPTR(bin);
+    if (((unsigned long)first_blk == (unsigned long)bp) && prev_bin == bin &&
+        !IS_TREE_BIN(bin) && !isLast(bp)) {
+#endif
+      if (size >= PURGE_MIN)
+        STAMP(bp) = purge_clock;
+      PUTPALLOC(HDRP(NEXT_BLKP(bp)), 0);
+      return bp;
+    }
+
+    // bp is the original prev block, move it to its new bin
+    removeBlk(bp, prev_bin);
+    insertBlk(bp, bin);
+    // update allocation state of next block
+    PUTPALLOC(HDRP(NEXT_BLKP(bp)), 0);
+  }
+  
+  return (void*)bp;
+}
+
+/* 
+ * splitBlk - Split a block that is allocated. When realloc is called and
+ *            asize <= csize
+ *            If block is splittable, coalesce the new free block
+ */
+static inline void splitBlk(void *oldptr, size_t asize, size_t csize) {
+  if (csize - asize < MINSIZE) {
+    // do nothing
+    return;
+  }
+  unsigned int palloc = GETPALLOC(HDRP(oldptr));
+  // otherwise, split and add new free block to beginning of bin
+  PUT(HDRP(oldptr), PACKPA(asize, 1, palloc));
+
+  size_t newsize = csize - asize;
+  char *nextptr = NEXT_BLKP(oldptr);
+
+  // free block
+  PUT(HDRP(nextptr), PACKPA(newsize, 0, 2));
+  PUT(FTRP(nextptr), PACK(newsize, 0));
+  coalesce(nextptr);
+}
+
+/*
+ * growBlk - Grow allocated block bp of csize bytes to asize bytes in place.
+ *           If the next block is free it is absorbed. If that is not
+ *           enough and the block after it is the epilogue, the heap is
+ *           extended by exactly the shortfall. Any surplus is split off.
+ *           Blocks above MAX_BLKSIZE are left to the mapping path.
+ *           Returns 1 on success, 0 (with nothing changed) otherwise.
+ */
+static int growBlk(void *bp, size_t asize, size_t csize) {
+  unsigned int palloc = GETPALLOC(HDRP(bp));
+  char *next = NEXT_BLKP(bp);
+  char *tail = next;
+  size_t total = csize;
+  int extended = 0;
+
+  // the header could not hold it
+  if (asize > MAX_BLKSIZE)
+    return 0;
+
+  if (!GET_ALLOC(HDRP(next))) {
+    total += GET_SIZE(HDRP(next));
+    tail = NEXT_BLKP(next);
+  }
+
+  if (total < asize) {
+    // only the last block can grow into the heap
+    if (GET_SIZE(HDRP(tail)) != 0)
+      return 0;
+    if ((long)grow_heap(asize - total) == -1)
+      return 0;
+    total = asize;
+    extended = 1;
+  }
+
+  if (next != tail) {
+    removeBlk(next, getBin(GET_SIZE(HDRP(next))));
+  }
+  PUT(HDRP(bp), PACKPA(total, 1, palloc));
+  if (extended) {
+    // the old epilogue is now inside bp, write the new one
+    PUT(HDRP(NEXT_BLKP(bp)), PACKPA(0, 1, 2));
+  } else {
+    PUTPALLOC(HDRP(NEXT_BLKP(bp)), 2);
+  }
+  dirtyTo(HDRP(NEXT_BLKP(bp)));
+
+  splitBlk(bp, asize, total);
+  return 1;
+}
+
+/*
+ * mergePrevBlk - Grow allocated block bp of csize bytes to asize bytes by
+ *                merging it with the free block before it, and with the
+ *                block after it if that is free too. The payload is moved
+ *                down only as far as needed, so the block keeps its end and
+ *                any surplus stays a free block in front of it. Splitting
+ *                the surplus off behind the block instead lets the next
+ *                small malloc land right after it and block growth again.
+ *                Returns the new block pointer, or NULL (with nothing
+ *                changed) if the merged block would be too small.
+ */
+static void *mergePrevBlk(void *bp, size_t asize, size_t csize) {
+  char *prev;
+  char *next = NEXT_BLKP(bp);
+  char *newbp;
+  size_t prev_size;
+  size_t total = csize;
+  size_t rem;
+  unsigned int palloc;
+
+  if (GETPALLOC(HDRP(bp)))
+    return NULL;
+
+  prev = PREV_BLKP(bp);
+  prev_size = GET_SIZE(HDRP(prev));
+  total += prev_size;
+  if (!GET_ALLOC(HDRP(next)))
+    total += GET_SIZE(HDRP(next));
+  if (total < asize)
+    return NULL;
+
+  removeBlk(prev, getBin(prev_size));
+  if (!GET_ALLOC(HDRP(next)))
+    removeBlk(next, getBin(GET_SIZE(HDRP(next))));
+
+  rem = total - asize;
+  if (rem < MINSIZE)
+    rem = 0;
+  newbp = prev + rem;
+  palloc = GETPALLOC(HDRP(prev));
+
+  // the payload is the block minus its header
+  memmove(newbp, bp, csize - WSIZE);
+
+  PUT(HDRP(newbp), PACKPA(total - rem, 1, rem ? 0 : palloc));
+  PUTPALLOC(HDRP(NEXT_BLKP(newbp)), 2);
+  dirtyTo(HDRP(NEXT_BLKP(newbp)));
+  if (rem) {
+    PUT(HDRP(prev), PACKPA(rem, 0, palloc));
+    PUT(FTRP(prev), PACK(rem, 0));
+    insertBlk(prev, getBin(rem));
+  }
+  return newbp;
+}
+
+/*
+ * mapLink - push mapped block bp onto mmap_list
+ */
+static void mapLink(char *bp) {
+  MAP_LOCK();
+  MAP_PREV(bp) = NULL;
+  MAP_NEXT(bp) = mmap_list;
+  if (mmap_list != NULL)
+    MAP_PREV(mmap_list) = bp;
+  mmap_list = bp;
+  MAP_UNLOCK();
+}
+
+/*
+ * mapUnlink - take mapped block bp out of mmap_list
+ */
+static void mapUnlink(char *bp) {
+  MAP_LOCK();
+  if (MAP_PREV(bp) != NULL)
+    MAP_NEXT(MAP_PREV(bp)) = MAP_NEXT(bp);
+  else
+    mmap_list = MAP_NEXT(bp);
+  if (MAP_NEXT(bp) != NULL)
+    MAP_PREV(MAP_NEXT(bp)) = MAP_PREV(bp);
+  MAP_UNLOCK();
+}
+
+/*
+ * mapBlk - allocate a block of asize bytes in a mapping of its own and add
+ *          it to mmap_list. Returns NULL if mem_mmap fails
+ */
+static void *mapBlk(size_t asize) {
+  size_t pagesize = mem_pagesize();
+  size_t len = (asize - WSIZE + MMAP_HDRSIZE + pagesize - 1) & ~(pagesize - 1);
+  char *base = mem_mmap(len);
+  char *bp;
+
+  if (base == (void *)-1)
+    return NULL;
+  bp = base + MMAP_HDRSIZE;
+  PUT(HDRP(bp), PACK(0, MAPPED | 1));
+  MAP_LEN(bp) = len;
+  mapLink(bp);
+  return bp;
+}
+
+/*
+ * unmapBlk - unlink mapped block bp from mmap_list and unmap it
+ */
+static void unmapBlk(char *bp) {
+  mapUnlink(bp);
+  mem_munmap(MAP_BASE(bp), MAP_LEN(bp));
+}
 
-    join(prev_prev, prev_next);
-    insertAtRoot(bp, bin, first_blk);
-    // update allocation state of next block
-    PUTPALLOC(HDRP(NEXT_BLKP(bp)), 0);
+/*
+ * remapBlk - resize mapped block bp to hold asize bytes, moving it if the
+ *            kernel has to. Returns the new block pointer, or NULL (and bp
+ *            is untouched) if mem_mremap fails
+ */
+static void *remapBlk(char *bp, size_t asize) {
+  size_t pagesize = mem_pagesize();
+  size_t len = (asize - WSIZE + MMAP_HDRSIZE + pagesize - 1) & ~(pagesize - 1);
+  char *base;
+
+  if (len == MAP_LEN(bp))
+    return bp;
+  // out of the list while it moves, so no neighbour is left pointing at
+  // the old address
+  mapUnlink(bp);
+  if ((base = mem_mremap(MAP_BASE(bp), MAP_LEN(bp), len)) == (void *)-1) {
+    mapLink(bp);
+    return NULL;
   }
+  bp = base + MMAP_HDRSIZE;
+  MAP_LEN(bp) = len;
+  mapLink(bp);
+  return bp;
+}
 
-  else {                                     /* Case 4 */
-    next = NEXT_BLKP(bp);
-    size += GET_SIZE(HDRP(PREV_BLKP(bp))) + 
-        GET_SIZE(FTRP(next));
-    bin = getBin(size);
-    prev_bin = getBin(GET_SIZE(HDRP(PREV_BLKP(bp))));
-    palloc = GETPALLOC(HDRP(PREV_BLKP(bp)));
-    PUT(HDRP(PREV_BLKP(bp)), PACKPA(size, 0, palloc));
-    PUT(FTRP(NEXT_BLKP(bp)), PACK(size, 0));
-    bp = PREV_BLKP(bp);
+#ifdef MM_SLAB
+/*
+ * isSlab - is p a slot in a slab page? Safe to call on any pointer
+ */
+static inline int isSlab(const void *p) {
+  unsigned long pg = ((unsigned long)p - (unsigned long)heap_start)
+                     >> SLAB_SHIFT;
 
-    // if next is not epilogue, get next and prev
-    if (next != NULL && (unsigned long)HDRP(next) != 1) {
-      next_next = GETNPTR(next);
-      next_prev = GETPPTR(next);
-    }
+  return pg < SLAB_PAGES && ((slab_map[pg / 64] >> (pg % 64)) & 1);
+}
 
-    join(next_prev, next_next);
+/*
+ * slabNew - make an empty slab for slots of size bytes, from a heap block
+ *           whose payload is a SLAB_SIZE-aligned page, and put it on its
+ *           list. Returns NULL if the heap is out of memory.
+ *           Caller holds heap_lock.
+ */
+static slab_t *slabNew(size_t size) {
+  // a block of exactly SLAB_SIZE bytes leaves room for the next block's
+  // header in front of the following page, so new slabs pack back to back
+  slab_t *slab = alignBlk(SLAB_SIZE, SLAB_SIZE);
+  unsigned long pg;
 
-    // get first block (we do it here to avoid nasty edge cases)
-    first_blk = GETNPTR(bin);
-    if (((unsigned long)first_blk == (unsigned long)bp) && prev_bin == bin) {
-      PUTPALLOC(HDRP(NEXT_BLKP(bp)), 0);
-      return bp;
-    }
+  if (slab == NULL)
+    return NULL;
+  slab->next = slab->prev = NULL;
+  slab->size = size;
+  slab->used = 0;
+  slab->free = 0;
+  slab->bump = SLAB_HDR;
+  slab_lists[SLAB_CLASS(size)] = slab;
+
+  pg = ((unsigned long)slab - (unsigned long)heap_start) >> SLAB_SHIFT;
+  slab_map[pg / 64] |= 1UL << (pg % 64);
+  if (pg / 64 + 1 > slab_hi)
+    slab_hi = pg / 64 + 1;
+  return slab;
+}
+
+/*
+ * slabUnlink - take slab off the list of its class
+ */
+static inline void slabUnlink(slab_t *slab) {
+  if (slab->prev != NULL)
+    slab->prev->next = slab->next;
+  else
+    slab_lists[SLAB_CLASS(slab->size)] = slab->next;
+  if (slab->next != NULL)
+    slab->next->prev = slab->prev;
+}
 
-    // get next and prev for bp, which is the original prev block
-    prev_prev = GETPPTR(bp);
-    prev_next = GETNPTR(bp);
+/*
+ * slab_alloc - take a slot for a request of size bytes (<= SLAB_MAX) from
+ *              the first slab on its list, making a slab if there is none.
+ *              Returns NULL if the heap is out of memory.
+ *              Caller holds heap_lock.
+ */
+static void *slab_alloc(size_t size) {
+  slab_t *slab = slab_lists[SLAB_CLASS(size)];
+  char *p;
 
-    join(prev_prev, prev_next);
-    insertAtRoot(bp, bin, first_blk);
-    // update allocation state of next block
-    PUTPALLOC(HDRP(NEXT_BLKP(bp)), 0);
+  if (slab == NULL && (slab = slabNew(ALIGN(size))) == NULL)
+    return NULL;
+  if (slab->free != 0) {
+    p = (char *)slab + slab->free;
+    slab->free = *(unsigned short *)p;
+  } else {
+    p = (char *)slab + slab->bump;
+    slab->bump += slab->size;
   }
-  
-  return (void*)bp;
+  // a full slab leaves the list until a slot is freed
+  if (++slab->used == SLAB_SLOTS(slab->size))
+    slabUnlink(slab);
+  return p;
 }
 
-/* 
- * splitBlk - Split a block that is allocated. When realloc is called and
- *            asize <= csize
- *            If block is splittable, coalesce the new free block
+/*
+ * slab_free - put slot p back in its slab. A slab that empties is freed,
+ *             unless no other slab of its class has a free slot.
+ *             Caller holds heap_lock.
  */
-static inline void splitBlk(void *oldptr, size_t asize, size_t csize) {
-  if (csize - asize < MINSIZE) {
-    // do nothing
-    return;
+static void slab_free(void *p) {
+  slab_t *slab = SLAB_OF(p);
+  slab_t **list = &slab_lists[SLAB_CLASS(slab->size)];
+  unsigned long pg;
+
+  *(unsigned short *)p = slab->free;
+  slab->free = (char *)p - (char *)slab;
+
+  // it was full, so it is not on the list
+  if (slab->used-- == SLAB_SLOTS(slab->size)) {
+    slab->prev = NULL;
+    slab->next = *list;
+    if (*list != NULL)
+      (*list)->prev = slab;
+    *list = slab;
   }
-  unsigned int palloc = GETPALLOC(HDRP(oldptr));
-  // otherwise, split and add new free block to beginning of bin
-  PUT(HDRP(oldptr), PACKPA(asize, 1, palloc));
-
-  size_t newsize = csize - asize;
-  char *nextptr = NEXT_BLKP(oldptr);
 
-  // free block
-  PUT(HDRP(nextptr), PACKPA(newsize, 0, 2));
-  PUT(FTRP(nextptr), PACK(newsize, 0));
-  coalesce(nextptr);
+  if (slab->used == 0 && (*list != slab || slab->next != NULL)) {
+    slabUnlink(slab);
+    pg = ((unsigned long)slab - (unsigned long)heap_start) >> SLAB_SHIFT;
+    slab_map[pg / 64] &= ~(1UL << (pg % 64));
+    free_blk(slab);
+  }
 }
+#endif /* def MM_SLAB */
 
 /* 
  * place - Place block of asize bytes at start of free block bp 
@@ -566,16 +2961,17 @@ static inline void splitBlk(void *oldptr, size_t asize, size_t csize) {
 static void place(void *bp, size_t asize)
 {
   char *bin;
-  char *first_blk;
   unsigned int palloc = GETPALLOC(HDRP(bp));
   size_t csize = GET_SIZE(HDRP(bp));
-  char *next = GETNPTR(bp);
-  char *prev = GETPPTR(bp);
+
+  // fix pointers of the bin bp is in
+  removeBlk(bp, getBin(csize));
 
   if ((csize - asize) >= MINSIZE) {
     // allocate the block
     // set previous allocation state
     PUT(HDRP(bp), PACKPA(asize, 1, palloc));
+    dirtyTo(HDRP(NEXT_BLKP(bp)));
     
     bp = NEXT_BLKP(bp);
     // new header and footer
@@ -584,70 +2980,316 @@ static void place(void *bp, size_t asize)
     PUT(FTRP(bp), PACK(csize-asize, 0));
     bin = getBin(csize - asize);
 
-    // fix pointers of next and prev blocks
-    join(prev, next);
-    // insert new free block into root of correct bin
-    first_blk = GETNPTR(bin);
-    insertAtRoot(bp, bin, first_blk);
+    // insert new free block into correct bin
+    insertBlk(bp, bin);
     // update pointer for next block
     PUTPALLOC(HDRP(NEXT_BLKP(bp)), 0);
   }
   else {
     PUT(HDRP(bp), PACKPA(csize, 1, palloc));
     PUTPALLOC(HDRP(NEXT_BLKP(bp)), 2);
-    // fix pointers of bin
-    join(prev, next);
+    dirtyTo(HDRP(NEXT_BLKP(bp)));
   }
 }
 
+#ifdef MM_TLSF
 /* 
- * find_fit - Find a fit for a block with asize bytes
- *            Best fit find that returns immediately if perfect fit is found,
- *            Otherwise picks best fit in first non-empty list
+ * find_fit - Find a fit for a block with asize bytes in constant time
+ *            If the head of asize's own list fits, take it. Otherwise round
+ *            asize up to the next list boundary and take the head of the
+ *            first non-empty list from there, found through fl_map/sl_map
  */
 static void *find_fit(size_t asize)
 {
-  void *bp;
-  void *best_fit;
-  size_t currBlkSize;
-  size_t diff = 0xffffffff; // largest possible difference in heap
-  char *bin = getBin(asize);
-
-  if (asize < 64) {
-    for (; bin != bin_end; bin += DSIZE) {
-      if(GETNPTR(bin) == END) continue;
-      for (bp = bin; bp != END; bp = (void*)GETNPTR(bp)) {
-        currBlkSize = GET_SIZE(HDRP(bp));
-        if (!GET_ALLOC(HDRP(bp)) && (asize <= currBlkSize))
-          return bp;
-      }
-    }
+  char *bp = GETNPTR(getBin(asize));
+  unsigned int i, fl, sl;
+  unsigned int map;
+
+  if (bp != END) {
+    FIT_NODE();
+    if (asize <= GET_SIZE(HDRP(bp)))
+      return bp;
   }
 
-  else {
-    for (; bin != bin_end; bin += DSIZE) {
-      if(GETNPTR(bin) == END) continue;
-      best_fit = bin;
-      for (bp = bin; bp != END; bp = (void*)GETNPTR(bp)) {
-        currBlkSize = GET_SIZE(HDRP(bp));
-        if (!GET_ALLOC(HDRP(bp)) && (asize == currBlkSize)) {
-          // perfect fit
-          return bp;
-        } else if (!GET_ALLOC(HDRP(bp)) && (asize < currBlkSize)) {
-          // if this is true, we have found a better fit
-          if (currBlkSize - asize < diff) {
-            diff = currBlkSize - asize;
-            best_fit = bp;
-          }
-        }
+  // every block in the list of the rounded size is at least asize
+  if (asize >= (1 << FL_SHIFT)) {
+    int log = 63 - __builtin_clzl(asize);
+    asize += (1UL << (log - SL_BITS)) - 1;
+  }
+  if (asize >> 32)
+    return NULL;
+
+  i = BIN_INDEX(getBin(asize));
+  fl = i / SL_COUNT;
+  sl = i % SL_COUNT;
+  map = sl_map[fl] & (~0U << sl);
+  if (map == 0) {
+    // nothing left in this power of 2, go to the next non-empty one
+    map = (fl + 1 < FL_COUNT) ? fl_map & (~0U << (fl + 1)) : 0;
+    if (map == 0)
+      return NULL; /* No fit */
+    fl = __builtin_ctz(map);
+    map = sl_map[fl];
+  }
+  sl = __builtin_ctz(map);
+  return GETNPTR(heap_listp + DSIZE*(fl*SL_COUNT + sl));
+}
+#elif defined(MM_ADDR_ORDER)
+/* 
+ * find_fit - Find a fit for a block with asize bytes
+ *            Address-ordered first fit: the lowest-addressed block of at
+ *            least asize bytes in the first non-empty bin that has one
+ *            (addrFit). fit_budget and fit_slack do not apply.
+ *            The tree bin is searched with treeFit
+ */
+static void *find_fit(size_t asize)
+{
+  char *bp;
+  char *bin;
+  // non-empty bins at or above the bin for asize
+  unsigned long map = bin_map & (~0UL << BIN_INDEX(getBin(asize)));
+
+  for (; map; map &= map - 1) {
+    bin = heap_listp + DSIZE * __builtin_ctzl(map);
+    if (bin == TREE_BIN)
+      return treeFit(asize);
+    if ((bp = addrFit(GETNPTR(bin), asize)) != NULL)
+      return bp;
+  }
+  return NULL; /* No fit */
+}
+#else
+/* 
+ * find_fit - Find a fit for a block with asize bytes
+ *            Good fit within a bin: in the first non-empty bin (found
+ *            through bin_map) that has a block of at least asize bytes,
+ *            compare up to fit_budget such blocks and take the smallest,
+ *            stopping early at one within fit_slack percent of asize.
+ *            Every block in the bins above is bigger, so the search never
+ *            goes past that bin. fit_budget 1 is first fit.
+ *            The tree bin is searched with treeFit
+ */
+static void *find_fit(size_t asize)
+{
+#ifdef MM_OOB_BINS
+  fdesc_t *d;
+  unsigned int j;
+#else
+  char *next;
+#endif
+  char *bp;
+  char *bin;
+  char *best = NULL;
+  size_t best_size = 0;
+  size_t size;
+  unsigned int seen = 0;
+  // a block of at most good bytes ends the search
+  size_t good = asize + asize * fit_slack / 100;
+  // non-empty bins at or above the bin for asize
+  unsigned long map = bin_map & (~0UL << BIN_INDEX(getBin(asize)));
+
+  for (; map; map &= map - 1) {
+    bin = heap_listp + DSIZE * __builtin_ctzl(map);
+    if (bin == TREE_BIN)
+      return treeFit(asize);
+#ifdef MM_OOB_BINS
+    // newest descriptors last, read no block until one is picked
+    d = oob_area + bin_vec[BIN_INDEX(bin)].base;
+    for (j = bin_vec[BIN_INDEX(bin)].len; j-- > 0; ) {
+      FIT_NODE();
+      bp = END + d[j].off;
+      size = d[j].size;
+#else
+    for (bp = GETNPTR(bin); bp != END; bp = next) {
+      // bp's line is in, start loading the next header while bp is checked
+      next = GETNPTR(bp);
+      PREFETCH(HDRP(next));
+      FIT_NODE();
+      size = GET_SIZE(HDRP(bp));
+#endif
+      if (asize > size)
+        continue;
+      if (best == NULL || size < best_size) {
+        best = bp;
+        best_size = size;
       }
-      // only case in which best_fit == bin is if list is empty
-      if (best_fit != bin)
-        return best_fit;
+      if (best_size <= good || ++seen == fit_budget)
+        return best;
     }
+    if (best != NULL)
+      return best;
+  }
+#ifdef MM_OOB_BINS
+  // blocks no vector had room for, before the caller turns to the top
+  for (bp = oob_spill; bp != END; bp = SPILL_NEXT(bp)) {
+    FIT_NODE();
+    if (GET_SIZE(HDRP(bp)) >= asize)
+      return bp;
   }
+#endif
   return NULL; /* No fit */
 }
+#endif /* MM_TLSF, MM_ADDR_ORDER */
+
+#ifdef MM_THREADSAFE
+/*
+ * The following routines implement the per-thread caches
+ */
+
+/*
+ * remote_free - push the chain first..last, linked through the payload,
+ *               onto remote_frees. Drain the queue right away if nobody
+ *               holds the lock, otherwise leave it to the lock holder,
+ *               which drains it when it unlocks (heap_unlock).
+ */
+static void remote_free(char *first, char *last) {
+  char *head = __atomic_load_n(&remote_frees, __ATOMIC_RELAXED);
+
+  // seq_cst pairs the push with the check in heap_unlock: either the
+  // holder sees the blocks after it unlocks, or our trylock succeeds
+  do {
+    *(char **)last = head;
+  } while (!__atomic_compare_exchange_n(&remote_frees, &head, first, 1,
+                                        __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+
+  if (pthread_mutex_trylock(&heap_lock) == 0) {
+    remote_drain();
+    UNLOCK();
+  }
+}
+
+/*
+ * heap_unlock - release heap_lock, then drain whatever remote_free pushed
+ *               while it was held: the pushing thread found the lock
+ *               taken and left its blocks to us. If another thread has
+ *               the lock again by then, its own unlock drains them.
+ */
+static void heap_unlock(void) {
+  pthread_mutex_unlock(&heap_lock);
+  while (__atomic_load_n(&remote_frees, __ATOMIC_SEQ_CST) != NULL &&
+         pthread_mutex_trylock(&heap_lock) == 0) {
+    remote_drain();
+    pthread_mutex_unlock(&heap_lock);
+  }
+}
+
+/*
+ * remote_drain - take every queued block and free it. Caller holds
+ *                heap_lock. Taking the whole stack at once means a block
+ *                is never popped while another thread pushes, so no ABA.
+ */
+static void remote_drain(void) {
+  char *bp = __atomic_exchange_n(&remote_frees, NULL, __ATOMIC_ACQUIRE);
+  char *next;
+
+  while (bp != NULL) {
+    next = *(char **)bp;
+    free_blk(bp);
+    bp = next;
+  }
+}
+
+/*
+ * tcache_flush - return the first n blocks of cache bin i to the heap,
+ *                as one chain through remote_free
+ */
+static void tcache_flush(tcache_t *tc, unsigned int i, unsigned int n) {
+  char *first = tc->bins[i];
+  char *last = first;
+
+  if (tc->gen != HEAP_GEN() || first == NULL || n == 0)
+    return;
+  tc->counts[i]--;
+  while (--n > 0 && *(char **)last != NULL) {
+    last = *(char **)last;
+    tc->counts[i]--;
+  }
+  tc->bins[i] = *(char **)last;
+  remote_free(first, last);
+}
+
+/*
+ * tcache_destroy - thread exit destructor, flush every cache bin
+ */
+static void tcache_destroy(void *arg) {
+  tcache_t *tc = arg;
+
+  for (unsigned int i = 0; i < TCACHE_BINS; i++) {
+    tcache_flush(tc, i, tc->counts[i]);
+  }
+}
+
+/*
+ * tcache_key_init - create the key whose destructor flushes on thread exit
+ */
+static void tcache_key_init(void) {
+  pthread_key_create(&tcache_key, tcache_destroy);
+}
+
+/*
+ * tcache_reset - empty the cache of the calling thread, whose blocks
+ *                belong to a heap that mm_init has since thrown away
+ */
+static void tcache_reset(tcache_t *tc) {
+  memset(tc->bins, 0, sizeof(tc->bins));
+  memset(tc->counts, 0, sizeof(tc->counts));
+  tc->gen = HEAP_GEN();
+  if (!tc->registered) {
+    pthread_once(&tcache_once, tcache_key_init);
+    pthread_setspecific(tcache_key, tc);
+    tc->registered = 1;
+  }
+}
+
+/*
+ * tcache_get - pop a block of at least asize bytes from the cache,
+ *              refilling the cache bin from the heap if it is empty
+ */
+static void *tcache_get(size_t asize) {
+  tcache_t *tc = &tcache;
+  unsigned int i = TCACHE_INDEX(asize);
+  char *bp = tc->bins[i];
+  char *extra;
+
+  if (bp != NULL && tc->gen == HEAP_GEN()) {
+    tc->bins[i] = *(char **)bp;
+    tc->counts[i]--;
+    return bp;
+  }
+
+  LOCK();
+  // allocate first, this may be what initializes the heap
+  bp = alloc_blk(asize);
+  if (tc->gen != HEAP_GEN())
+    tcache_reset(tc);
+  for (int n = 1; bp != NULL && n < TCACHE_FILL; n++) {
+    if ((extra = alloc_blk(asize)) == NULL)
+      break;
+    *(char **)extra = tc->bins[i];
+    tc->bins[i] = extra;
+    tc->counts[i]++;
+  }
+  UNLOCK();
+  return bp;
+}
+
+/*
+ * tcache_put - push a block of at least size bytes onto the cache bin for
+ *              size, flushing half of the cache bin back to the heap once
+ *              it is over TCACHE_COUNT
+ */
+static void tcache_put(void *ptr, size_t size) {
+  tcache_t *tc = &tcache;
+  unsigned int i = TCACHE_INDEX(size);
+
+  if (tc->gen != HEAP_GEN())
+    tcache_reset(tc);
+  *(char **)ptr = tc->bins[i];
+  tc->bins[i] = ptr;
+  if (++tc->counts[i] > TCACHE_COUNT)
+    tcache_flush(tc, i, TCACHE_COUNT / 2);
+}
+#endif /* def MM_THREADSAFE */
 
 /*
  * Return whether the pointer is in the heap.
@@ -715,6 +3357,179 @@ void check_prev_next(char *bp, int lineno) {
   }
 }
 
+#ifndef MM_TLSF
+/*
+ * check_tree - check the subtree of the tree bin rooted at bp, whose parent
+ *              should be parent. Checks that every node is a free block in
+ *              the heap, of size >= 8192, with a correct parent pointer,
+ *              in (size, address) order and in treap priority order.
+ *              Returns the number of nodes in the subtree.
+ */
+static int check_tree(char *bp, char *parent, int lineno) {
+  if (bp == END)
+    return 0;
+  PREFETCH(HDRP(GETLEFT(bp)));
+  PREFETCH(HDRP(GETRIGHT(bp)));
+
+  if (!in_heap(bp) || GET_ALLOC(HDRP(bp)) || 
+      getBin(GET_SIZE(HDRP(bp))) != TREE_BIN) {
+    fprintf(stderr, "Error: bad block (%lx) in tree bin (%d)\n",
+            (unsigned long)bp, lineno);
+    exit(-1);
+  }
+  if (GETPARENT(bp) != parent) {
+    fprintf(stderr, "Error: tree block (%lx) parent pointer is wrong (%d)\n",
+            (unsigned long)bp, lineno);
+    exit(-1);
+  }
+  if (parent != TREE_BIN && PRIORITY(bp) > PRIORITY(parent)) {
+    fprintf(stderr, "Error: tree block (%lx) outranks its parent (%d)\n",
+            (unsigned long)bp, lineno);
+    exit(-1);
+  }
+  if ((GETLEFT(bp) != END && !treeLess(GETLEFT(bp), bp)) ||
+      (GETRIGHT(bp) != END && !treeLess(bp, GETRIGHT(bp)))) {
+    fprintf(stderr, "Error: tree block (%lx) children out of order (%d)\n",
+            (unsigned long)bp, lineno);
+    exit(-1);
+  }
+  return 1 + check_tree(GETLEFT(bp), bp, lineno) +
+             check_tree(GETRIGHT(bp), bp, lineno);
+}
+#endif
+
+#ifdef MM_ADDR_ORDER
+/*
+ * check_addr - check the subtree at bp of the treap of list bin bin: every
+ *              node is a free block in the heap of that bin, between lo
+ *              and hi (NULL for no bound) in address order, and does not
+ *              outrank parent. Returns the number of nodes.
+ */
+static int check_addr(char *bp, char *bin, char *lo, char *hi, char *parent,
+                      int lineno) {
+  if (bp == END)
+    return 0;
+  PREFETCH(HDRP(GETLEFT(bp)));
+  PREFETCH(HDRP(GETRIGHT(bp)));
+
+  if (!in_heap(bp) || GET_ALLOC(HDRP(bp)) ||
+      getBin(GET_SIZE(HDRP(bp))) != bin || bp <= lo ||
+      (hi != NULL && bp >= hi) ||
+      (parent != NULL && PRIORITY(bp) > PRIORITY(parent))) {
+    fprintf(stderr, "Error: bad block (%lx) in address-ordered bin %u (%d)\n",
+            (unsigned long)bp, BIN_INDEX(bin), lineno);
+    exit(-1);
+  }
+  return 1 + check_addr(GETLEFT(bp), bin, lo, bp, bp, lineno) +
+             check_addr(GETRIGHT(bp), bin, bp, hi, bp, lineno);
+}
+#endif
+
+#ifdef MM_OOB_BINS
+/*
+ * check_descs - check the descriptors of list bin bin: its vector lies in
+ *               the used part of oob_area, and every descriptor names a
+ *               free block in the heap of that bin, with the block's size,
+ *               that holds the descriptor's index. Returns their number.
+ */
+static int check_descs(char *bin, int lineno) {
+  fvec_t *v = &bin_vec[BIN_INDEX(bin)];
+  fdesc_t *d = oob_area + v->base;
+  char *bp;
+
+  if (v->len > v->cap || (v->cap && v->base + v->cap > oob_top) ||
+      oob_top * sizeof(fdesc_t) > oob_len) {
+    fprintf(stderr, "Error: bin %u vector out of oob_area (%d)\n",
+            BIN_INDEX(bin), lineno);
+    exit(-1);
+  }
+  for (unsigned int j = 0; j < v->len; j++) {
+    bp = END + d[j].off;
+    if (!in_heap(bp) || GET_ALLOC(HDRP(bp)) ||
+        d[j].size != GET_SIZE(HDRP(bp)) || getBin(d[j].size) != bin ||
+        DESC_IDX(bp) != j) {
+      fprintf(stderr, "Error: bad descriptor %u (%lx) in bin %u (%d)\n",
+              j, (unsigned long)bp, BIN_INDEX(bin), lineno);
+      exit(-1);
+    }
+  }
+  return v->len;
+}
+
+/*
+ * check_spill - check that every block on oob_spill is a free block in
+ *               the heap marked UNBINNED. Returns their number.
+ */
+static int check_spill(int lineno) {
+  int n = 0;
+
+  for (char *bp = oob_spill; bp != END; bp = SPILL_NEXT(bp), n++) {
+    if (!in_heap(bp) || GET_ALLOC(HDRP(bp)) || DESC_IDX(bp) != UNBINNED) {
+      fprintf(stderr, "Error: bad spilled block (%lx) (%d)\n",
+              (unsigned long)bp, lineno);
+      exit(-1);
+    }
+  }
+  return n;
+}
+#endif
+
+/*
+ * check_mapped - check every block in mmap_list: it must be marked mapped
+ *                and allocated, lie outside the heap in a mapping of whole
+ *                pages, and be linked back by its successor
+ */
+static void check_mapped(int lineno) {
+  char *prev = NULL;
+
+  MAP_LOCK();
+  for (char *bp = mmap_list; bp != NULL; prev = bp, bp = MAP_NEXT(bp)) {
+    if (GET(HDRP(bp)) != PACK(0, MAPPED | 1) || in_heap(bp)) {
+      fprintf(stderr, "Error: bad mapped block (%lx) (%d)\n",
+              (unsigned long)bp, lineno);
+      exit(-1);
+    }
+    if (MAP_LEN(bp) % mem_pagesize() != 0 ||
+        !mem_is_mapped(MAP_BASE(bp), MAP_BASE(bp) + MAP_LEN(bp) - 1)) {
+      fprintf(stderr, "Error: mapped block (%lx) has wrong length (%d)\n",
+              (unsigned long)bp, lineno);
+      exit(-1);
+    }
+    if (MAP_PREV(bp) != prev) {
+      fprintf(stderr, "Error: mapped block (%lx) prev pointer is wrong (%d)\n",
+              (unsigned long)bp, lineno);
+      exit(-1);
+    }
+  }
+  MAP_UNLOCK();
+}
+
+#ifdef MM_SLAB
+/*
+ * check_slabs - check that every slab on a list is marked in slab_map,
+ *               inside an allocated heap block, of the list's class and
+ *               not full, and that the list links agree
+ */
+static void check_slabs(int lineno) {
+  slab_t *prev;
+
+  for (int c = 0; c < SLAB_CLASSES; c++) {
+    prev = NULL;
+    for (slab_t *slab = slab_lists[c]; slab != NULL; slab = slab->next) {
+      if (!isSlab(slab) || !in_heap(slab) || !GET_ALLOC(HDRP(slab)) ||
+          GET_SIZE(HDRP(slab)) < SLAB_SIZE ||
+          SLAB_CLASS(slab->size) != c ||
+          slab->used >= SLAB_SLOTS(slab->size) || slab->prev != prev) {
+        fprintf(stderr, "Error: bad slab (%lx) (%d)\n",
+                (unsigned long)slab, lineno);
+        exit(-1);
+      }
+      prev = slab;
+    }
+  }
+}
+#endif
+
 /*
  * mm_checkheap - checks heap for correctness
  * 
@@ -735,10 +3550,22 @@ void check_prev_next(char *bp, int lineno) {
  * Check that each bin contains only free blocks
  * Check that each block in each bin is the correct size
  * Check that each free block is in the heap
+ * Check that bin_map (fl_map/sl_map) agrees with which bins are non-empty
+ * Check the structure of the tree bin (see check_tree)
+ * Check the blocks in their own mappings (see check_mapped)
  * 
  * Check that the free blocks in the heap and in the free list matches
  */
 void mm_checkheap(int lineno) {
+  LOCK();
+  check_heap(lineno);
+  UNLOCK();
+}
+
+/*
+ * check_heap - does the work of mm_checkheap. Caller holds heap_lock.
+ */
+static void check_heap(int lineno) {
   int alloc;
 
   int free_blks = 0;
@@ -812,6 +3639,16 @@ void mm_checkheap(int lineno) {
     }
   }
 
+  // the wilderness is the last block if that is free, and in no bin
+  if ((wild != NULL) != !GETPALLOC(HDRP(bp)) ||
+      (wild != NULL && NEXT_BLKP(wild) != bp)) {
+    fprintf(stderr, "Error: wilderness (%lx) is not the last free block (%d)\n",
+            (unsigned long)wild, lineno);
+    exit(-1);
+  }
+  if (wild != NULL)
+    free_list_blks++;
+
   // check epilogue placement
   if (bp != (char*)(mem_heap_hi() + 1)) {
     fprintf(stderr, "Error: epilogue (%lx) is not end of heap (%lx)(%d)\n",
@@ -825,7 +3662,37 @@ void mm_checkheap(int lineno) {
   // requires that each bin is in the correct place
   char *currBin;
   for (char *bin = getBin(16); bin != bin_end; bin += DSIZE) {
+    // check that the bin's bit in bin_map matches its emptiness
+#ifdef MM_OOB_BINS
+    if (bin != TREE_BIN) {
+      if ((bin_vec[BIN_INDEX(bin)].len != 0) != binMarked(bin)) {
+        fprintf(stderr, "Error: bin_map bit %u is wrong (%d)\n",
+                BIN_INDEX(bin), lineno);
+        exit(-1);
+      }
+      free_list_blks += check_descs(bin, lineno);
+      continue;
+    }
+#endif
+    if ((GETNPTR(bin) != END) != binMarked(bin)) {
+      fprintf(stderr, "Error: bin_map bit %u is wrong (%d)\n",
+              BIN_INDEX(bin), lineno);
+      exit(-1);
+    }
+#ifndef MM_TLSF
+    if (bin == TREE_BIN) {
+      free_list_blks += check_tree(GETNPTR(bin), bin, lineno);
+      continue;
+    }
+#endif
+#ifdef MM_ADDR_ORDER
+    free_list_blks += check_addr(GETNPTR(bin), bin, heap_start, NULL, NULL,
+                                 lineno);
+    continue;
+#endif
     for (bp = bin; bp != END; bp = (char*)GETNPTR(bp)) {
+      // the next block is checked next, start loading it
+      PREFETCH(HDRP(GETNPTR(bp)));
       // check consistency of prev/next pointers
       check_prev_next(bp, lineno);
       // check that current block is free
@@ -857,6 +3724,19 @@ void mm_checkheap(int lineno) {
     }
   }
 
+#ifdef MM_TLSF
+  // check that fl_map summarizes sl_map
+  for (int fl = 0; fl < FL_COUNT; fl++) {
+    if ((sl_map[fl] != 0) != ((fl_map >> fl) & 1)) {
+      fprintf(stderr, "Error: fl_map bit %d is wrong (%d)\n", fl, lineno);
+      exit(-1);
+    }
+  }
+#endif
+#ifdef MM_OOB_BINS
+  free_list_blks += check_spill(lineno);
+#endif
+
   // number of free blocks in heap and in list is the same
   if (free_blks != free_list_blks) {
     fprintf(stderr, 
@@ -864,6 +3744,11 @@ void mm_checkheap(int lineno) {
             free_blks, free_list_blks, lineno);
     exit(-1);
   }
+
+  check_mapped(lineno);
+#ifdef MM_SLAB
+  check_slabs(lineno);
+#endif
 }
 
 
@@ -7,6 +7,13 @@ extern void *mm_malloc (size_t size);
 extern void mm_free (void *ptr);
 extern void *mm_realloc(void *ptr, size_t size);
 extern void *mm_calloc (size_t nmemb, size_t size);
+extern void *mm_memalign(size_t alignment, size_t size);
+extern int mm_posix_memalign(void **memptr, size_t alignment, size_t size);
+extern void *mm_aligned_alloc(size_t alignment, size_t size);
+extern size_t mm_malloc_usable_size(void *ptr);
+extern void mm_free_sized(void *ptr, size_t size);
+extern size_t mm_malloc_batch(size_t size, size_t n, void **out);
+extern void mm_free_batch(void **ptrs, size_t n);
 
 #else
 
@@ -15,10 +22,35 @@ extern void *malloc (size_t size);
 extern void free (void *ptr);
 extern void *realloc(void *ptr, size_t size);
 extern void *calloc (size_t nmemb, size_t size);
+extern void *memalign(size_t alignment, size_t size);
+extern int posix_memalign(void **memptr, size_t alignment, size_t size);
+extern void *aligned_alloc(size_t alignment, size_t size);
+extern size_t malloc_usable_size(void *ptr);
+extern void free_sized(void *ptr, size_t size);
+extern size_t malloc_batch(size_t size, size_t n, void **out);
+extern void free_batch(void **ptrs, size_t n);
 
 #endif
 
 extern int mm_init(void);
+extern int mm_trim(size_t pad);
+extern void mm_frag_stats(size_t *free_bytes, size_t *largest);
+extern void mm_fit_policy(unsigned int budget, unsigned int slack);
+extern void mm_fit_stats(unsigned long *calls, unsigned long *nodes,
+                         unsigned long *cycles);
+
+/* Bump-pointer arenas, freed all at once */
+typedef struct mm_arena mm_arena_t;
+extern mm_arena_t *mm_arena_create(void);
+extern void *mm_arena_alloc(mm_arena_t *arena, size_t size);
+extern void mm_arena_destroy(mm_arena_t *arena);
+
+/* Pools of headerless fixed-size slots */
+typedef struct mm_pool mm_pool_t;
+extern mm_pool_t *mm_pool_create(size_t obj_size);
+extern void *mm_pool_alloc(mm_pool_t *pool);
+extern void mm_pool_free(mm_pool_t *pool, void *p);
+extern void mm_pool_destroy(mm_pool_t *pool);
 
 /* This is largely for debugging. */
 extern void mm_checkheap(int lineno);